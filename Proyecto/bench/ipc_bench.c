@@ -0,0 +1,392 @@
+/**
+ * @file ipc_bench.c
+ * @author Enmanuel, Jorge
+ * @brief benchmark of the transports that move blocks between processes
+ * @version 0.1
+ * @date 2023-05-25
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * A producer and a consumer process exchange messages of one or more
+ * blocks over a pipe, a POSIX MQ, the shm ring of the monitor and a Unix
+ * socket. Each configuration runs twice:
+ *
+ * - latency: one message at a time, the producer sends the next one when
+ *   the consumer has received the previous one. The one way latency is the
+ *   time between the send and the receive, on the same monotonic clock.
+ * - throughput: the producer sends every message as fast as the transport
+ *   takes them, the rate is measured from the first send to the last
+ *   receive.
+ *
+ * Both processes are pinned to different CPUs or left to the scheduler. The
+ * results are printed and optionally written as CSV.
+ */
+
+#define _GNU_SOURCE
+#include "../includes/miner.h"
+#include "../includes/ring.h"
+#include "../includes/args.h"
+#include <sched.h>
+#include <sys/socket.h>
+
+#define BENCH_MQ "/ipc_bench_mq"
+#define BENCH_MAX_BATCH 256
+#define BENCH_MAX_LIST 16
+
+/**
+ * @brief transports measured
+ */
+typedef enum _transport{
+    T_PIPE,
+    T_MQ,
+    T_RING,
+    T_UNIX,
+    NUM_TRANSPORTS
+} Transport;
+
+static const char *transport_names[NUM_TRANSPORTS] = {"pipe", "mq", "ring", "unix"};
+
+/**
+ * @brief state shared by the producer and the consumer, mapped before the fork
+ */
+typedef struct _shared{
+    uint64_t received; // messages received, the producer waits on it in latency mode
+    uint64_t first_sent;
+    uint64_t last_received;
+    Histogram latency; // ns, written by the consumer only
+    SharedMemory ring;
+} Shared;
+
+/**
+ * @brief ends of a transport, both processes keep all of them
+ */
+typedef struct _channel{
+    Transport transport;
+    int fds[2]; // pipe or socket, read end first
+    mqd_t mq;
+    int sub; // ring subscriber of the consumer
+} Channel;
+
+/**
+ * @brief measurements of one configuration
+ */
+typedef struct _result{
+    Transport transport;
+    int batch;
+    int pinned;
+    int latency; // 1 latency run, 0 throughput run
+    long messages;
+    uint64_t p50, p90, p99, max; // ns
+    double rate; // messages/s
+    double bandwidth; // MB/s
+} Result;
+
+static volatile sig_atomic_t never = 0; // ring_push and ring_pop stop flag
+
+/**
+ * @brief private function that pins the caller to a CPU
+ */
+static void pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        perror("sched_setaffinity");
+}
+
+/**
+ * @brief private function that writes a whole buffer on a stream
+ */
+static int write_full(int fd, const void *buf, size_t size) {
+    ssize_t n;
+    size_t done = 0;
+    while (done < size) {
+        if ((n = write(fd, (const char*)buf + done, size - done)) <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief private function that reads a whole buffer from a stream
+ */
+static int read_full(int fd, void *buf, size_t size) {
+    ssize_t n;
+    size_t done = 0;
+    while (done < size) {
+        if ((n = read(fd, (char*)buf + done, size - done)) <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief private function that opens a transport
+ * @return int 0 on success, -1 if it cannot carry messages of this size
+ */
+static int channel_open(Channel *ch, Transport transport, Shared *shared, int batch) {
+    struct mq_attr attr;
+    ch->transport = transport;
+    switch (transport) {
+    case T_PIPE:
+        return pipe(ch->fds);
+    case T_UNIX:
+        return socketpair(AF_UNIX, SOCK_STREAM, 0, ch->fds);
+    case T_MQ:
+        attr = (struct mq_attr){
+            .mq_flags = 0,
+            .mq_maxmsg = MAX_MSG,
+            .mq_msgsize = batch * sizeof(Block),
+            .mq_curmsgs = 0
+        };
+        mq_unlink(BENCH_MQ);
+        ch->mq = mq_open(BENCH_MQ, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+        return ch->mq == (mqd_t) -1 ? -1 : 0;
+    case T_RING:
+        ring_init(&shared->ring, 0, 0);
+        // subscribed before the fork, so the producer never runs ahead of it
+        return (ch->sub = ring_subscribe(&shared->ring, NULL)) == -1 ? -1 : 0;
+    default:
+        return -1;
+    }
+}
+
+static void channel_close(Channel *ch) {
+    if (ch->transport == T_PIPE || ch->transport == T_UNIX) {
+        close(ch->fds[0]);
+        close(ch->fds[1]);
+    } else if (ch->transport == T_MQ) {
+        mq_close(ch->mq);
+        mq_unlink(BENCH_MQ);
+    }
+}
+
+static int channel_send(Channel *ch, Shared *shared, const Block *blocks, int batch) {
+    BlockInfo info = {0};
+    int i;
+    switch (ch->transport) {
+    case T_PIPE:
+        return write_full(ch->fds[1], blocks, batch * sizeof(Block));
+    case T_UNIX:
+        return write_full(ch->fds[0], blocks, batch * sizeof(Block));
+    case T_MQ:
+        return mq_send(ch->mq, (const char*)blocks, batch * sizeof(Block), 1);
+    case T_RING:
+        for (i = 0; i < batch; i++)
+            if (ring_push(&shared->ring, &blocks[i], &info, &never) == -1)
+                return -1;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static int channel_receive(Channel *ch, Shared *shared, Block *blocks, int batch) {
+    BlockInfo info;
+    int i;
+    switch (ch->transport) {
+    case T_PIPE:
+        return read_full(ch->fds[0], blocks, batch * sizeof(Block));
+    case T_UNIX:
+        return read_full(ch->fds[1], blocks, batch * sizeof(Block));
+    case T_MQ:
+        return mq_receive(ch->mq, (char*)blocks, batch * sizeof(Block), NULL) == -1 ? -1 : 0;
+    case T_RING:
+        for (i = 0; i < batch; i++)
+            if (ring_pop(&shared->ring, ch->sub, &blocks[i], &info, &never) == -1)
+                return -1;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief private function that runs one configuration
+ * @return int 0 on success, 1 if the transport cannot carry it, -1 on error
+ */
+static int run(Shared *shared, Transport transport, int batch, int pinned, int latency, long messages, Result *result) {
+    static Block blocks[BENCH_MAX_BATCH];
+    Channel ch;
+    pid_t pid;
+    long i;
+    int status, cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t t = 0;
+
+    memset(shared, 0, sizeof(Shared));
+    memset(blocks, 0, sizeof(blocks));
+    if (channel_open(&ch, transport, shared, batch) == -1)
+        return 1;
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        channel_close(&ch);
+        return -1;
+    }
+    if (pid == 0) { // consumer
+        if (pinned)
+            pin(cpus > 1 ? 1 : 0);
+        for (i = 0; i < messages; i++) {
+            if (channel_receive(&ch, shared, blocks, batch) == -1)
+                _exit(EXIT_FAILURE);
+            t = now_ns();
+            hist_record(&shared->latency, t - blocks[0].sent_ns);
+            __atomic_store_n(&shared->received, i + 1, __ATOMIC_RELEASE);
+        }
+        shared->last_received = t;
+        _exit(EXIT_SUCCESS);
+    }
+    if (pinned)
+        pin(0);
+    shared->first_sent = now_ns();
+    for (i = 0; i < messages; i++) {
+        if (latency) // one message in flight, an idle transport
+            while (__atomic_load_n(&shared->received, __ATOMIC_ACQUIRE) < (uint64_t)i)
+                sched_yield();
+        blocks[0].sent_ns = now_ns();
+        if (channel_send(&ch, shared, blocks, batch) == -1) {
+            perror("send");
+            kill(pid, SIGKILL);
+            break;
+        }
+    }
+    waitpid(pid, &status, 0);
+    channel_close(&ch);
+    if (pinned) { // back to every CPU for the next configuration
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (i = 0; i < cpus; i++)
+            CPU_SET(i, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        return -1;
+
+    result->transport = transport;
+    result->batch = batch;
+    result->pinned = pinned;
+    result->latency = latency;
+    result->messages = messages;
+    result->p50 = hist_percentile(&shared->latency, 50);
+    result->p90 = hist_percentile(&shared->latency, 90);
+    result->p99 = hist_percentile(&shared->latency, 99);
+    result->max = shared->latency.max;
+    t = shared->last_received - shared->first_sent;
+    result->rate = messages * 1e9 / t;
+    result->bandwidth = result->rate * batch * sizeof(Block) / 1e6;
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--transports=pipe,mq,ring,unix] [--batch=N,...] [--messages=N]\n"
+                    "       [--pin=yes|no|both] [--out=FILE]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for the benchmark
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    static Result results[NUM_TRANSPORTS * BENCH_MAX_LIST * 4];
+    long batches[BENCH_MAX_LIST] = {1, 8, 64}, messages = 20000;
+    int transports[NUM_TRANSPORTS] = {T_PIPE, T_MQ, T_RING, T_UNIX};
+    int num_transports = NUM_TRANSPORTS, num_batches = 3, pin_first = 0, pin_last = 1;
+    int i, b, k, p, mode, ret, n = 0;
+    char *out = NULL, *token;
+    Shared *shared;
+    FILE *file;
+
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--transports=", 13)) {
+            for (num_transports = 0, token = strtok(argv[i] + 13, ","); token; token = strtok(NULL, ",")) {
+                for (k = 0; k < NUM_TRANSPORTS && strcmp(token, transport_names[k]); k++)
+                    ;
+                if (k == NUM_TRANSPORTS || num_transports == NUM_TRANSPORTS) {
+                    fprintf(stdout, "unknown transport %s\n", token);
+                    exit(EXIT_FAILURE);
+                }
+                transports[num_transports++] = k;
+            }
+        }
+        else if (!strncmp(argv[i], "--batch=", 8) && (num_batches = parse_list(argv[i] + 8, batches, BENCH_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--messages=", 11) && (messages = atol(argv[i] + 11)) > 0)
+            continue;
+        else if (!strcmp(argv[i], "--pin=yes"))
+            pin_first = pin_last = 1;
+        else if (!strcmp(argv[i], "--pin=no"))
+            pin_first = pin_last = 0;
+        else if (!strcmp(argv[i], "--pin=both"))
+            pin_first = 0, pin_last = 1;
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else
+            usage(argv[0]);
+    }
+    for (b = 0; b < num_batches; b++) {
+        if (batches[b] > BENCH_MAX_BATCH) {
+            fprintf(stdout, "at most %d blocks per message\n", BENCH_MAX_BATCH);
+            exit(EXIT_FAILURE);
+        }
+    }
+    shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    if (pin_last && sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        fprintf(stdout, "one CPU only, pinned runs share it\n");
+
+    fprintf(stdout, "block: %zu bytes\n", sizeof(Block));
+    fprintf(stdout, "%-6s %6s %4s %-10s %10s %10s %10s %10s %12s %10s\n", "transp", "batch", "pin", "mode",
+                "p50 ns", "p90 ns", "p99 ns", "max ns", "msgs/s", "MB/s");
+    for (k = 0; k < num_transports; k++) {
+        for (b = 0; b < num_batches; b++) {
+            for (p = pin_first; p <= pin_last; p++) {
+                for (mode = 1; mode >= 0; mode--) {
+                    if ((ret = run(shared, transports[k], batches[b], p, mode, messages, &results[n])) == 1) {
+                        fprintf(stdout, "%-6s %6ld %4s %-10s cannot carry %zu bytes\n", transport_names[transports[k]],
+                                    batches[b], p ? "yes" : "no", "both", batches[b] * sizeof(Block));
+                        break;
+                    } else if (ret == -1) {
+                        fprintf(stdout, "%s failed\n", transport_names[transports[k]]);
+                        munmap(shared, sizeof(Shared));
+                        exit(EXIT_FAILURE);
+                    }
+                    fprintf(stdout, "%-6s %6d %4s %-10s %10lu %10lu %10lu %10lu %12.0f %10.1f\n",
+                                transport_names[results[n].transport], results[n].batch, p ? "yes" : "no",
+                                mode ? "latency" : "throughput", (unsigned long)results[n].p50,
+                                (unsigned long)results[n].p90, (unsigned long)results[n].p99,
+                                (unsigned long)results[n].max, results[n].rate, results[n].bandwidth);
+                    fflush(stdout);
+                    n++;
+                }
+            }
+        }
+    }
+    munmap(shared, sizeof(Shared));
+
+    if (out) {
+        if ((file = fopen(out, "w")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(file, "transport,batch,pinned,mode,messages,bytes,p50_ns,p90_ns,p99_ns,max_ns,msgs_per_sec,mb_per_sec\n");
+        for (i = 0; i < n; i++)
+            fprintf(file, "%s,%d,%d,%s,%ld,%zu,%lu,%lu,%lu,%lu,%.0f,%.3f\n", transport_names[results[i].transport],
+                        results[i].batch, results[i].pinned, results[i].latency ? "latency" : "throughput",
+                        results[i].messages, results[i].batch * sizeof(Block), (unsigned long)results[i].p50,
+                        (unsigned long)results[i].p90, (unsigned long)results[i].p99, (unsigned long)results[i].max,
+                        results[i].rate, results[i].bandwidth);
+        fclose(file);
+    }
+    return 0;
+}
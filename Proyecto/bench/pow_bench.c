@@ -0,0 +1,272 @@
+/**
+ * @file pow_bench.c
+ * @author Enmanuel, Jorge
+ * @brief microbenchmark of the pow_hash search kernels
+ * @version 0.1
+ * @date 2023-05-23
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every kernel searches a range for a target that is never hit, so the
+ * whole range is hashed, split between the threads like the miner does.
+ * Each configuration is measured reps times after a warm up run and
+ * reported as the median ns/hash of one thread and its spread (median
+ * absolute deviation), plus the hashes/s of all the threads together.
+ *
+ * The results are written as CSV. Given a baseline written by an earlier
+ * run, each configuration is compared with it and the run fails if one
+ * got slower by more than the threshold.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/pow.h"
+#include "../includes/args.h"
+
+#define BENCH_MAX_REPS 101
+#define BENCH_MAX_LIST 16
+#define BENCH_MAX_THREADS 256
+#define BENCH_MAX_RESULTS (POW_NUM_KERNELS * BENCH_MAX_LIST * BENCH_MAX_LIST)
+
+/**
+ * @brief measurements of one configuration
+ */
+typedef struct _result{
+    char kernel[16];
+    long range;
+    int threads;
+    int reps;
+    double median; // ns/hash of one thread
+    double mad; // median absolute deviation, % of the median
+    double min;
+    double max;
+    double rate; // hashes/s of all the threads
+} Result;
+
+/**
+ * @brief work of one thread
+ */
+typedef struct _benchThread{
+    PowSearch search;
+    long start;
+    long end;
+    long found;
+} BenchThread;
+
+static void *bench_work(void *args) {
+    BenchThread *thread = (BenchThread*) args;
+    thread->found = thread->search(thread->start, thread->end, -1);
+    return NULL;
+}
+
+/**
+ * @brief private function that runs a kernel once on all the threads
+ * @return double wall time in ns, -1 on error
+ */
+static double run_once(PowSearch search, long range, int nthreads) {
+    pthread_t threads[BENCH_MAX_THREADS];
+    BenchThread work[BENCH_MAX_THREADS];
+    uint64_t start;
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        work[i].search = search;
+        work[i].start = range * i / nthreads;
+        work[i].end = range * (i + 1) / nthreads;
+    }
+    start = now_ns();
+    if (nthreads == 1) {
+        bench_work(&work[0]);
+        return now_ns() - start;
+    }
+    for (i = 0; i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, bench_work, &work[i]))
+            return -1;
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    return now_ns() - start;
+}
+
+static int by_value(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int n) {
+    qsort(values, n, sizeof(double), by_value);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/**
+ * @brief private function that measures one configuration
+ */
+static int measure(const PowKernel *kernel, long range, int nthreads, int reps, Result *result) {
+    double samples[BENCH_MAX_REPS], deviations[BENCH_MAX_REPS], wall;
+    int i;
+
+    if (run_once(kernel->search, range, nthreads) < 0) // warm up
+        return -1;
+    for (i = 0; i < reps; i++) {
+        if ((wall = run_once(kernel->search, range, nthreads)) < 0)
+            return -1;
+        samples[i] = wall * nthreads / range; // each thread hashes range / nthreads
+    }
+    memset(result, 0, sizeof(Result));
+    strncpy(result->kernel, kernel->name, sizeof(result->kernel) - 1);
+    result->range = range;
+    result->threads = nthreads;
+    result->reps = reps;
+    result->median = median(samples, reps);
+    result->min = samples[0];
+    result->max = samples[reps - 1];
+    for (i = 0; i < reps; i++)
+        deviations[i] = samples[i] > result->median ? samples[i] - result->median : result->median - samples[i];
+    result->mad = 100 * median(deviations, reps) / result->median;
+    result->rate = 1e9 * nthreads / result->median;
+    return 0;
+}
+
+/**
+ * @brief private function that checks that every kernel finds the same solutions
+ * @return int 0 if they agree, -1 if not
+ */
+static int check_kernels() {
+    long x, targets[] = {pow_hash(0), pow_hash(1), pow_hash(7), pow_hash(12345), pow_hash(99999), -1};
+    unsigned t;
+    int k;
+    for (t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+        x = pow_search_scalar(0, 100000, targets[t]);
+        for (k = 0; k < POW_NUM_KERNELS; k++) {
+            if (pow_kernels[k].search(0, 100000, targets[t]) != x) {
+                fprintf(stdout, "kernel %s disagrees with scalar on target %ld\n", pow_kernels[k].name, targets[t]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief private function that reads a results file
+ * @return int number of results, -1 if it cannot be read
+ */
+static int load_results(const char *path, Result *results) {
+    FILE *file;
+    char line[256];
+    int n = 0;
+    if ((file = fopen(path, "r")) == NULL)
+        return -1;
+    while (n < BENCH_MAX_RESULTS && fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%15[^,],%ld,%d,%d,%lf,%lf,%lf,%lf,%lf", results[n].kernel, &results[n].range,
+                    &results[n].threads, &results[n].reps, &results[n].median, &results[n].mad,
+                    &results[n].min, &results[n].max, &results[n].rate) == 9)
+            n++; // the header does not parse
+    }
+    fclose(file);
+    return n;
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--reps=N] [--ranges=N,...] [--threads=N,...] [--kernels=NAME,...]\n"
+                    "       [--out=FILE] [--baseline=FILE] [--threshold=PCT]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for the benchmark
+ * @return 0 Exit success, 1 on error or if a kernel got slower than the baseline
+ */
+int main(int argc, char *argv[]) {
+    static Result results[BENCH_MAX_RESULTS], baseline[BENCH_MAX_RESULTS];
+    long ranges[BENCH_MAX_LIST] = {100000, 1000000, 10000000}, threads[BENCH_MAX_LIST] = {1, 2, 4};
+    const PowKernel *kernels[POW_NUM_KERNELS];
+    int num_ranges = 3, num_threads = 3, num_kernels = POW_NUM_KERNELS, reps = 7;
+    int i, k, r, t, n = 0, num_baseline = 0, regressions = 0;
+    double threshold = 10, delta;
+    char *out = NULL, *base = NULL, *token;
+    FILE *file;
+
+    for (k = 0; k < POW_NUM_KERNELS; k++)
+        kernels[k] = &pow_kernels[k];
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--reps=", 7) && (reps = atoi(argv[i] + 7)) > 0 && reps <= BENCH_MAX_REPS)
+            continue;
+        else if (!strncmp(argv[i], "--ranges=", 9) && (num_ranges = parse_list(argv[i] + 9, ranges, BENCH_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--threads=", 10) && (num_threads = parse_list(argv[i] + 10, threads, BENCH_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--kernels=", 10)) {
+            for (num_kernels = 0, token = strtok(argv[i] + 10, ","); token; token = strtok(NULL, ",")) {
+                if (num_kernels == POW_NUM_KERNELS || (kernels[num_kernels++] = pow_kernel(token)) == NULL) {
+                    fprintf(stdout, "unknown kernel %s\n", token);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else if (!strncmp(argv[i], "--baseline=", 11))
+            base = argv[i] + 11;
+        else if (!strncmp(argv[i], "--threshold=", 12) && (threshold = atof(argv[i] + 12)) > 0)
+            continue;
+        else
+            usage(argv[0]);
+    }
+    for (t = 0; t < num_threads; t++) {
+        if (threads[t] > BENCH_MAX_THREADS) {
+            fprintf(stdout, "at most %d threads\n", BENCH_MAX_THREADS);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (check_kernels() == -1)
+        exit(EXIT_FAILURE);
+    if (base && (num_baseline = load_results(base, baseline)) == -1)
+        fprintf(stdout, "no baseline in %s\n", base);
+
+    fprintf(stdout, "%-12s %10s %7s %10s %7s %10s %10s %14s %9s\n",
+                "kernel", "range", "threads", "ns/hash", "mad%", "min", "max", "hashes/s", "baseline");
+    for (k = 0; k < num_kernels; k++) {
+        for (r = 0; r < num_ranges; r++) {
+            for (t = 0; t < num_threads; t++) {
+                if (measure(kernels[k], ranges[r], threads[t], reps, &results[n]) == -1) {
+                    perror("pthread_create");
+                    exit(EXIT_FAILURE);
+                }
+                fprintf(stdout, "%-12s %10ld %7d %10.3f %7.2f %10.3f %10.3f %14.0f", results[n].kernel,
+                            results[n].range, results[n].threads, results[n].median, results[n].mad,
+                            results[n].min, results[n].max, results[n].rate);
+                for (i = 0; i < num_baseline; i++) {
+                    if (strcmp(baseline[i].kernel, results[n].kernel) || baseline[i].range != results[n].range ||
+                                baseline[i].threads != results[n].threads)
+                        continue;
+                    // positive is slower
+                    delta = 100 * (results[n].median - baseline[i].median) / baseline[i].median;
+                    fprintf(stdout, " %+8.1f%%", delta);
+                    if (delta > threshold) {
+                        fprintf(stdout, " SLOWER");
+                        regressions++;
+                    }
+                    break;
+                }
+                fprintf(stdout, "\n");
+                fflush(stdout);
+                n++;
+            }
+        }
+    }
+
+    if (out) {
+        if ((file = fopen(out, "w")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(file, "kernel,range,threads,reps,ns_per_hash,mad_pct,min_ns,max_ns,hashes_per_sec\n");
+        for (i = 0; i < n; i++)
+            fprintf(file, "%s,%ld,%d,%d,%.4f,%.3f,%.4f,%.4f,%.0f\n", results[i].kernel, results[i].range,
+                        results[i].threads, results[i].reps, results[i].median, results[i].mad,
+                        results[i].min, results[i].max, results[i].rate);
+        fclose(file);
+    }
+    if (regressions)
+        fprintf(stdout, "%d configurations slower than the baseline by more than %.1f%%\n", regressions, threshold);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
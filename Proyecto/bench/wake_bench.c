@@ -0,0 +1,359 @@
+/**
+ * @file wake_bench.c
+ * @author Enmanuel, Jorge
+ * @brief benchmark of the primitives that wake up the miners for a round
+ * @version 0.1
+ * @date 2023-05-26
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * A notifier process wakes up N waiter processes once per round, like the
+ * winner starting the next round, with one of:
+ *
+ * - signal: SIGUSR1 to every waiter, waiting in sigsuspend like the miner
+ * - sem: a process shared semaphore, posted once per waiter
+ * - futex: a generation counter and one wake all
+ * - eventfd: one write of N to a semaphore mode eventfd
+ * - cond: a process shared condition variable and a broadcast
+ *
+ * Before each round the notifier waits until every waiter has gone back
+ * to sleep, plus a settle time for them to get into the kernel. The wake up
+ * latency is the time from the notification to the waiter running again.
+ * For each round the first and the last waiter to wake up are kept, the
+ * last one is the cost of the fan out, and so is the time spent in the
+ * notifying call.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/args.h"
+#include <sys/eventfd.h>
+
+#define BENCH_MAX_WAITERS 64
+#define BENCH_MAX_LIST 16
+
+/**
+ * @brief primitives measured
+ */
+typedef enum _mechanism{
+    M_SIGNAL,
+    M_SEM,
+    M_FUTEX,
+    M_EVENTFD,
+    M_COND,
+    NUM_MECHANISMS
+} Mechanism;
+
+static const char *mechanism_names[NUM_MECHANISMS] = {"signal", "sem", "futex", "eventfd", "cond"};
+
+/**
+ * @brief state shared by the notifier and the waiters, mapped before the fork
+ */
+typedef struct _shared{
+    uint32_t ready; // waiters going to sleep, over all the rounds
+    uint32_t done; // waiters woken up, over all the rounds
+    uint32_t generation; // round notified, futex and cond
+    uint32_t finished; // round measured, no waiter goes back to sleep before
+    uint64_t notified_ns; // when the notification started
+    uint64_t latency[BENCH_MAX_WAITERS]; // ns, of the last round, one writer each
+    sem_t sem;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Histogram first; // ns, first waiter awake
+    Histogram last; // ns, last waiter awake
+    Histogram call; // ns, inside the notifying call
+} Shared;
+
+/**
+ * @brief measurements of one configuration
+ */
+typedef struct _result{
+    Mechanism mechanism;
+    int waiters;
+    long rounds;
+    uint64_t first_p50, first_p99, last_p50, last_p99, last_max, call_p50; // ns
+} Result;
+
+volatile sig_atomic_t woken = 0;
+
+void signal_handler(int sig) {
+    woken = 1;
+}
+
+static void sleep_us(long us) {
+    struct timespec t = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&t, NULL);
+}
+
+/**
+ * @brief private function that waits until a shared counter reaches a value
+ */
+static void wait_count(uint32_t *counter, uint32_t value) {
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value)
+        sched_yield();
+}
+
+/**
+ * @brief private function with the loop of a waiter process
+ */
+static void waiter(Shared *shared, Mechanism mechanism, int efd, int index, long rounds) {
+    sigset_t unblocked;
+    uint64_t value;
+    uint32_t round;
+
+    sigprocmask(SIG_BLOCK, NULL, &unblocked);
+    sigdelset(&unblocked, SIGUSR1);
+    for (round = 1; round <= rounds; round++) {
+        __atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+        switch (mechanism) {
+        case M_SIGNAL: // SIGUSR1 is blocked outside sigsuspend, it cannot get lost
+            while (!woken)
+                sigsuspend(&unblocked);
+            woken = 0;
+            break;
+        case M_SEM:
+            while (sem_wait(&shared->sem) == -1)
+                ;
+            break;
+        case M_FUTEX:
+            while (__atomic_load_n(&shared->generation, __ATOMIC_ACQUIRE) < round)
+                futex_wait(&shared->generation, round - 1);
+            break;
+        case M_EVENTFD:
+            while (read(efd, &value, sizeof(value)) != sizeof(value))
+                ;
+            break;
+        case M_COND:
+            pthread_mutex_lock(&shared->mutex);
+            while (shared->generation < round)
+                pthread_cond_wait(&shared->cond, &shared->mutex);
+            pthread_mutex_unlock(&shared->mutex);
+            break;
+        default:
+            break;
+        }
+        shared->latency[index] = now_ns() - __atomic_load_n(&shared->notified_ns, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&shared->done, 1, __ATOMIC_RELEASE);
+        // otherwise a fast waiter could take the sem or eventfd count of a slow one
+        wait_count(&shared->finished, round);
+    }
+}
+
+/**
+ * @brief private function that wakes up every waiter once
+ */
+static void notify(Shared *shared, Mechanism mechanism, int efd, const pid_t *pids, int n, uint32_t round) {
+    uint64_t value = n;
+    int i;
+    switch (mechanism) {
+    case M_SIGNAL:
+        for (i = 0; i < n; i++)
+            kill(pids[i], SIGUSR1);
+        break;
+    case M_SEM:
+        for (i = 0; i < n; i++)
+            sem_post(&shared->sem);
+        break;
+    case M_FUTEX:
+        __atomic_store_n(&shared->generation, round, __ATOMIC_RELEASE);
+        futex_wake(&shared->generation);
+        break;
+    case M_EVENTFD:
+        if (write(efd, &value, sizeof(value)) != sizeof(value))
+            perror("write");
+        break;
+    case M_COND:
+        pthread_mutex_lock(&shared->mutex);
+        shared->generation = round;
+        pthread_cond_broadcast(&shared->cond);
+        pthread_mutex_unlock(&shared->mutex);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief private function that runs one configuration
+ * @return int 0 on success, -1 on error
+ */
+static int run(Shared *shared, Mechanism mechanism, int n, long rounds, long settle_us, Result *result) {
+    pid_t pids[BENCH_MAX_WAITERS];
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    uint64_t first, last, t;
+    uint32_t round;
+    int i, efd = -1, status, failed = 0;
+
+    memset(shared, 0, sizeof(Shared));
+    sem_init(&shared->sem, 1, 0);
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->mutex, &mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shared->cond, &cattr);
+    if (mechanism == M_EVENTFD && (efd = eventfd(0, EFD_SEMAPHORE)) == -1) {
+        perror("eventfd");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if ((pids[i] = fork()) == -1) {
+            perror("fork");
+            n = i;
+            failed = 1;
+            break;
+        }
+        if (pids[i] == 0) {
+            waiter(shared, mechanism, efd, i, rounds);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    for (round = 1; round <= rounds && !failed; round++) {
+        wait_count(&shared->ready, round * n);
+        sleep_us(settle_us); // the last waiter still has to get into the kernel
+        t = now_ns();
+        __atomic_store_n(&shared->notified_ns, t, __ATOMIC_RELEASE);
+        notify(shared, mechanism, efd, pids, n, round);
+        hist_record(&shared->call, now_ns() - t);
+        wait_count(&shared->done, round * n);
+        first = last = shared->latency[0];
+        for (i = 1; i < n; i++) {
+            if (shared->latency[i] < first)
+                first = shared->latency[i];
+            if (shared->latency[i] > last)
+                last = shared->latency[i];
+        }
+        hist_record(&shared->first, first);
+        hist_record(&shared->last, last);
+        __atomic_store_n(&shared->finished, round, __ATOMIC_RELEASE);
+    }
+    for (i = 0; i < n; i++) {
+        if (failed)
+            kill(pids[i], SIGKILL);
+        waitpid(pids[i], &status, 0);
+    }
+    if (efd != -1)
+        close(efd);
+    pthread_cond_destroy(&shared->cond);
+    pthread_mutex_destroy(&shared->mutex);
+    sem_destroy(&shared->sem);
+    if (failed)
+        return -1;
+
+    result->mechanism = mechanism;
+    result->waiters = n;
+    result->rounds = rounds;
+    result->first_p50 = hist_percentile(&shared->first, 50);
+    result->first_p99 = hist_percentile(&shared->first, 99);
+    result->last_p50 = hist_percentile(&shared->last, 50);
+    result->last_p99 = hist_percentile(&shared->last, 99);
+    result->last_max = shared->last.max;
+    result->call_p50 = hist_percentile(&shared->call, 50);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--mechanisms=signal,sem,futex,eventfd,cond] [--waiters=N,...]\n"
+                    "       [--rounds=N] [--settle=US] [--out=FILE]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for the benchmark
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    static Result results[NUM_MECHANISMS * BENCH_MAX_LIST];
+    long waiters[BENCH_MAX_LIST] = {1, 2, 4, 8}, rounds = 2000, settle_us = 50;
+    int mechanisms[NUM_MECHANISMS] = {M_SIGNAL, M_SEM, M_FUTEX, M_EVENTFD, M_COND};
+    int num_mechanisms = NUM_MECHANISMS, num_waiters = 4;
+    int i, k, w, n = 0;
+    char *out = NULL, *token;
+    struct sigaction act;
+    sigset_t mask;
+    Shared *shared;
+    FILE *file;
+
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--mechanisms=", 13)) {
+            for (num_mechanisms = 0, token = strtok(argv[i] + 13, ","); token; token = strtok(NULL, ",")) {
+                for (k = 0; k < NUM_MECHANISMS && strcmp(token, mechanism_names[k]); k++)
+                    ;
+                if (k == NUM_MECHANISMS || num_mechanisms == NUM_MECHANISMS) {
+                    fprintf(stdout, "unknown mechanism %s\n", token);
+                    exit(EXIT_FAILURE);
+                }
+                mechanisms[num_mechanisms++] = k;
+            }
+        }
+        else if (!strncmp(argv[i], "--waiters=", 10) && (num_waiters = parse_list(argv[i] + 10, waiters, BENCH_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--rounds=", 9) && (rounds = atol(argv[i] + 9)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--settle=", 9) && (settle_us = atol(argv[i] + 9)) >= 0)
+            continue;
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else
+            usage(argv[0]);
+    }
+    for (w = 0; w < num_waiters; w++) {
+        if (waiters[w] > BENCH_MAX_WAITERS) {
+            fprintf(stdout, "at most %d waiters\n", BENCH_MAX_WAITERS);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // inherited by the waiters: SIGUSR1 only arrives inside sigsuspend
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGUSR1, &act, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "%-8s %7s %11s %11s %11s %11s %11s %11s\n", "mechan.", "waiters",
+                "first p50", "first p99", "last p50", "last p99", "last max", "call p50");
+    for (k = 0; k < num_mechanisms; k++) {
+        for (w = 0; w < num_waiters; w++) {
+            if (run(shared, mechanisms[k], waiters[w], rounds, settle_us, &results[n]) == -1) {
+                munmap(shared, sizeof(Shared));
+                exit(EXIT_FAILURE);
+            }
+            fprintf(stdout, "%-8s %7d %11lu %11lu %11lu %11lu %11lu %11lu  (ns)\n",
+                        mechanism_names[results[n].mechanism], results[n].waiters,
+                        (unsigned long)results[n].first_p50, (unsigned long)results[n].first_p99,
+                        (unsigned long)results[n].last_p50, (unsigned long)results[n].last_p99,
+                        (unsigned long)results[n].last_max, (unsigned long)results[n].call_p50);
+            fflush(stdout);
+            n++;
+        }
+    }
+    munmap(shared, sizeof(Shared));
+
+    if (out) {
+        if ((file = fopen(out, "w")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(file, "mechanism,waiters,rounds,first_p50_ns,first_p99_ns,last_p50_ns,last_p99_ns,last_max_ns,call_p50_ns\n");
+        for (i = 0; i < n; i++)
+            fprintf(file, "%s,%d,%ld,%lu,%lu,%lu,%lu,%lu,%lu\n", mechanism_names[results[i].mechanism],
+                        results[i].waiters, results[i].rounds, (unsigned long)results[i].first_p50,
+                        (unsigned long)results[i].first_p99, (unsigned long)results[i].last_p50,
+                        (unsigned long)results[i].last_p99, (unsigned long)results[i].last_max,
+                        (unsigned long)results[i].call_p50);
+        fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file args.h
+ * @author Enmanuel, Jorge
+ * @brief Parsing of the command line options shared by the tools and benchmarks
+ * @version 0.1
+ * @date 2023-06-03
+ *
+ * @copyright Copyright (c) 2023
+ */
+
+#ifndef _ARGS_H
+#define _ARGS_H
+
+/**
+ * @brief parse a comma separated list of positive numbers, the text is modified
+ * @param text list, as in --threads=1,2,4
+ * @param values where the numbers are written
+ * @param max size of values
+ * @return int number of values, -1 on error
+ */
+int parse_list(char *text, long *values, int max);
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file chain.h
+ * @author Enmanuel, Jorge
+ * @brief Compressed binary encoding of the chain log written by the register
+ * @version 0.1
+ * @date 2023-05-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * A chain log is a small header followed by one record per block:
+ *
+ *      [tag: 1 byte][payload length: varint][payload]
+ *
+ * Keyframe records ('K') hold the full block. Delta records ('D') are
+ * encoded against the previous block: the id and the target (which should
+ * equal the previous solution) are stored as zigzag varint deltas and the
+ * wallets only as the entries that changed. A keyframe is written every
+ * keyframe_interval blocks, so a reader can start decoding at any keyframe
+ * and skip the rest of the records by their length without decoding them.
+ */
+
+#ifndef _CHAIN_H
+#define _CHAIN_H
+
+#include "miner.h"
+
+#define CHAIN_MAGIC "CHN1"
+#define CHAIN_HEADER_SIZE 8 /*!< magic + little endian keyframe interval */
+#define CHAIN_KEYFRAME_INTERVAL 64
+#define CHAIN_TAG_KEY 'K'
+#define CHAIN_TAG_DELTA 'D'
+#define CHAIN_MAX_RECORD 2048 /*!< upper bound for an encoded record */
+
+/**
+ * @brief Encoder/decoder state, only the previous block is kept
+ */
+typedef struct _chainCodec{
+    Block prev; // last block encoded or decoded
+    uint32_t keyframe_interval; // blocks between keyframes
+    uint32_t since_key; // blocks encoded since the last keyframe
+    uint8_t has_prev; // 0 until the first keyframe has been seen
+} ChainCodec;
+
+/**
+ * @brief initialize a codec
+ *
+ * @param codec codec to initialize
+ * @param keyframe_interval blocks between keyframes, 0 for the default
+ */
+void chain_codec_init(ChainCodec *codec, uint32_t keyframe_interval);
+
+/**
+ * @brief encode a block as the next record of the chain
+ *
+ * @param codec codec state, updated with the block
+ * @param block block to encode
+ * @param out buffer of at least CHAIN_MAX_RECORD bytes
+ * @return size_t number of bytes written into out
+ */
+size_t chain_encode(ChainCodec *codec, const Block *block, uint8_t *out);
+
+/**
+ * @brief decode the record at the start of in
+ *
+ * @param codec codec state, updated with the decoded block
+ * @param in encoded data
+ * @param len bytes available in in
+ * @param block decoded block, wallets past num_voters are zeroed
+ * @return long bytes consumed, -1 if the record is truncated or corrupt
+ */
+long chain_decode(ChainCodec *codec, const uint8_t *in, size_t len, Block *block);
+
+/**
+ * @brief read the tag and total length of the record at the start of in
+ *
+ * @param in encoded data
+ * @param len bytes available in in
+ * @param tag tag of the record (can be NULL)
+ * @return long total length of the record, -1 if truncated
+ */
+long chain_record_span(const uint8_t *in, size_t len, uint8_t *tag);
+
+/**
+ * @brief find the first keyframe at or after offset, skipping records by length
+ *
+ * @param in whole chain log (header included)
+ * @param len size of the log
+ * @param offset offset of a record boundary to start from
+ * @return long offset of the keyframe, len if there are none left
+ */
+long chain_next_keyframe(const uint8_t *in, size_t len, size_t offset);
+
+/**
+ * @brief write the chain log header
+ *
+ * @param fd file to write into
+ * @param keyframe_interval blocks between keyframes
+ * @return int 0 on success, -1 on error
+ */
+int chain_write_header(int fd, uint32_t keyframe_interval);
+
+/**
+ * @brief validate the chain log header
+ *
+ * @param in whole chain log
+ * @param len size of the log
+ * @param keyframe_interval interval read from the header (can be NULL)
+ * @return int 0 if the header is valid, -1 if not
+ */
+int chain_read_header(const uint8_t *in, size_t len, uint32_t *keyframe_interval);
+
+#endif
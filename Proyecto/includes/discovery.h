@@ -0,0 +1,80 @@
+/**
+ * @file discovery.h
+ * @author Enmanuel, Jorge
+ * @brief Event driven attach to the shared memory segments of the peers
+ * @version 0.1
+ * @date 2023-05-19
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Instead of polling shm_open, a process watches /dev/shm with inotify and
+ * sleeps until the segment is created and sized. Once mapped, it sleeps in
+ * a futex on the ready flag of the segment until its creator finished
+ * initializing it.
+ */
+
+#ifndef _DISCOVERY_H
+#define _DISCOVERY_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define SHM_DIR "/dev/shm"
+
+/**
+ * @brief map a shared memory segment that may outlive its processes, without waiting
+ * @param name name of the segment, as given to shm_open
+ * @param size size of the segment
+ * @param create 1 to create it if missing, whoever finds it empty sizes it and the new pages are zeroed
+ * @param writable 1 to map it for writing, required to create it
+ * @return void* mapping, NULL if it is not there or on error (errno is set)
+ */
+void *shm_attach(const char *name, size_t size, int create, int writable);
+
+/**
+ * @brief open a shared memory segment, sleeping until it exists and has size bytes
+ * @param name name of the segment, as given to shm_open
+ * @param oflag O_RDONLY or O_RDWR
+ * @param size minimum size of the segment
+ * @param stop gives up when this becomes set
+ * @return int file descriptor, -1 if stopped or on error
+ */
+int wait_for_shm(const char *name, int oflag, size_t size, volatile sig_atomic_t *stop);
+
+/**
+ * @brief sleep until a ready flag in shared memory is set
+ * @param flag ready flag
+ * @param stop gives up when this becomes set
+ * @return int 0 when ready, -1 if stopped
+ */
+int wait_ready(uint32_t *flag, volatile sig_atomic_t *stop);
+
+/**
+ * @brief set a ready flag and wake up whoever waits for it
+ * @param flag ready flag
+ */
+void set_ready(uint32_t *flag);
+
+/**
+ * @brief sleep while *addr == value, until woken up or interrupted
+ * @param addr futex word in shared memory
+ * @param value expected value
+ */
+void futex_wait(uint32_t *addr, uint32_t value);
+
+/**
+ * @brief sleep while *addr == value, until woken up, interrupted or timeout_ns passed
+ * @param addr futex word in shared memory
+ * @param value expected value
+ * @param timeout_ns longest sleep
+ */
+void futex_wait_timed(uint32_t *addr, uint32_t value, long timeout_ns);
+
+/**
+ * @brief wake up every process sleeping on addr
+ * @param addr futex word in shared memory
+ */
+void futex_wake(uint32_t *addr);
+
+#endif
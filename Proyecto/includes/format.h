@@ -0,0 +1,82 @@
+/**
+ * @file format.h
+ * @author Enmanuel, Jorge
+ * @brief Output of the monitor: one formatting pass per block into a reusable buffer
+ * @version 0.1
+ * @date 2023-05-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Blocks are formatted by hand (no stdio) into an output buffer that is
+ * written with a single write(). On a terminal every block is written at
+ * once; otherwise blocks are batched until the buffer fills or the caller
+ * flushes because no more blocks are ready.
+ */
+
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include "miner.h"
+#include "ring.h"
+
+#define OUTPUT_SIZE 65536
+#define OUTPUT_MAX_BLOCK 4096 // upper bound of a formatted block
+
+/**
+ * @brief formats of the monitor output
+ */
+typedef enum _outputFormat{
+    FORMAT_TEXT, // the classic human readable blocks
+    FORMAT_JSON, // JSON Lines, one object per block
+    FORMAT_CSV // compact CSV, header fields only
+} OutputFormat;
+
+/**
+ * @brief output buffer
+ */
+typedef struct _output{
+    int fd; // where the output goes
+    uint8_t batch; // 0 on a terminal, write every block at once
+    OutputFormat format;
+    size_t len; // bytes pending
+    char buf[OUTPUT_SIZE];
+} Output;
+
+/**
+ * @brief parse the name of a format
+ * @param name text, json or csv
+ * @param format parsed format
+ * @return int 0 on success, -1 if unknown
+ */
+int output_parse_format(const char *name, OutputFormat *format);
+
+/**
+ * @brief initialize an output, writes the CSV header if needed
+ * @param out output
+ * @param fd file descriptor to write to
+ * @param format format of the blocks
+ */
+void output_init(Output *out, int fd, OutputFormat format);
+
+/**
+ * @brief format a block into the output, writing it if the output is not batched
+ * @param out output
+ * @param block block
+ * @param info what the comprobador found out about the block
+ */
+void output_block(Output *out, const Block *block, const BlockInfo *info);
+
+/**
+ * @brief report blocks the monitor lost
+ * @param out output
+ * @param lost number of blocks
+ */
+void output_lost(Output *out, int lost);
+
+/**
+ * @brief write whatever is pending
+ * @param out output
+ */
+void output_flush(Output *out);
+
+#endif
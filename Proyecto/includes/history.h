@@ -0,0 +1,102 @@
+/**
+ * @file history.h
+ * @author Enmanuel, Jorge
+ * @brief Persistent history of the blocks published by the comprobador
+ * @version 0.1
+ * @date 2023-05-21
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * A file mapped by the comprobador holding the last HISTORY_LENGTH blocks
+ * it published, numbered with a sequence that keeps growing across
+ * restarts. Every block goes into the history before it goes into the
+ * ring, so a monitor that subscribes to the ring and then replays the
+ * history up to the first block of its subscription misses nothing.
+ *
+ * There is one writer and the readers never lock: like the ring slots,
+ * each slot has a version, 2 * (seq + 1) once the block of seq is complete
+ * and odd while it is written, so an overwritten slot is detected.
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include "miner.h"
+#include "ring.h"
+
+#define HISTORY_FILE "facepulls.hist"
+#define HISTORY_MAGIC "FPHIST1"
+#define HISTORY_LENGTH 4096 // power of two
+
+/**
+ * @brief slot of the history
+ */
+typedef struct _historySlot{
+    uint64_t version;
+    BlockInfo info;
+    Block block;
+} HistorySlot;
+
+/**
+ * @brief layout of the history file
+ */
+typedef struct _historyFile{
+    char magic[8]; // HISTORY_MAGIC
+    uint32_t length; // HISTORY_LENGTH
+    uint32_t slot_size; // sizeof(HistorySlot), changes with the Block layout
+    uint64_t head; // sequence of the next block
+    HistorySlot slots[HISTORY_LENGTH];
+} HistoryFile;
+
+/**
+ * @brief History structure, a mapped history and a read position
+ */
+typedef struct _history{
+    HistoryFile *file;
+    uint64_t next; // next block to read
+    uint64_t end; // the reader stops here
+} History;
+
+/**
+ * @brief map a history file
+ * @param history history
+ * @param path file
+ * @param writer 1 for the comprobador: creates or resets the file if needed
+ * @return int 0 on success, -1 on error
+ */
+int history_open(History *history, const char *path, uint8_t writer);
+
+/**
+ * @brief unmap a history file
+ * @param history history
+ */
+void history_close(History *history);
+
+/**
+ * @brief append a block
+ * @param history history, opened as writer
+ * @param block block
+ * @param info what the comprobador found out about the block
+ * @return uint64_t sequence of the block
+ */
+uint64_t history_append(History *history, const Block *block, const BlockInfo *info);
+
+/**
+ * @brief set the range to read
+ * @param history history
+ * @param from first sequence, negative to count back from end
+ * @param end sequence where reading stops
+ */
+void history_seek(History *history, int64_t from, uint64_t end);
+
+/**
+ * @brief read the next block of the range
+ * @param history history
+ * @param block where the block is copied
+ * @param info where the information about the block is copied
+ * @param lost incremented with the blocks of the range already overwritten
+ * @return int 0 on success, -1 when the range is over
+ */
+int history_read(History *history, Block *block, BlockInfo *info, uint64_t *lost);
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * @file ledger.h
+ * @author Enmanuel, Jorge
+ * @brief Wallet ledger, authoritative balance table kept in the System segment
+ * @version 0.1
+ * @date 2023-05-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Open addressing hash table keyed by wallet id. A miner started with
+ * --wallet=ID owns a stable wallet that is saved in the checkpoints and
+ * found again after a restart; a miner without one gets a wallet of its
+ * own process, keyed by its pid with LEDGER_EPHEMERAL set, that is never
+ * saved. Entries are claimed with a compare and swap on the id and
+ * balances are updated with atomic adds, readers never take a lock.
+ *
+ * The wallet of a process is removed when its miner leaves, and swept when
+ * the ledger fills up if the process is gone without leaving. A removed
+ * entry becomes a tombstone that lookups skip and new wallets reuse.
+ * Wallets are only created and removed with the System mutex held.
+ *
+ * The register and the monitor report the balances from a snapshot of the
+ * ledger, taken through a read only mapping of the segment that holds it.
+ */
+
+#ifndef _LEDGER_H
+#define _LEDGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LEDGER_BITS 10
+#define LEDGER_SIZE (1 << LEDGER_BITS) /*!< slots, several times MAX_MINERS */
+#define LEDGER_EPHEMERAL 0x80000000u /*!< set in the ids of the wallets of a process */
+#define LEDGER_MAX_ID 0x7fffffff /*!< highest stable wallet id */
+#define LEDGER_PID_WALLET(pid) (LEDGER_EPHEMERAL | (uint32_t)(pid))
+#define LEDGER_TOMBSTONE 0xffffffffu /*!< id of a removed entry, no pid reaches it */
+
+/**
+ * @brief Ledger entry, id 0 means free
+ */
+typedef struct _ledgerEntry{
+    uint32_t id; // wallet id
+    int32_t coins; // balance
+} LedgerEntry;
+
+/**
+ * @brief Ledger structure, lives in shared memory
+ */
+typedef struct _ledger{
+    LedgerEntry entries[LEDGER_SIZE];
+    uint32_t count; // entries in use
+} Ledger;
+
+/**
+ * @brief add delta coins to a wallet, creating it if needed
+ * @param ledger ledger
+ * @param id wallet id
+ * @param delta coins to add
+ * @return int32_t new balance, -1 if the ledger is full
+ */
+int32_t ledger_credit(Ledger *ledger, uint32_t id, int32_t delta);
+
+/**
+ * @brief balance of a wallet
+ * @param ledger ledger
+ * @param id wallet id
+ * @return int32_t balance, 0 if the wallet does not exist
+ */
+int32_t ledger_balance(const Ledger *ledger, uint32_t id);
+
+/**
+ * @brief remove a wallet and its balance
+ * @param ledger ledger
+ * @param id wallet id
+ */
+void ledger_remove(Ledger *ledger, uint32_t id);
+
+/**
+ * @brief remove the wallets of the processes that are gone
+ * @param ledger ledger
+ * @return int wallets removed
+ */
+int ledger_sweep(Ledger *ledger);
+
+/**
+ * @brief copy the wallets in use
+ * @param ledger ledger
+ * @param out wallets copied
+ * @param max size of out
+ * @param stable 1 to copy only the stable wallets, the ones checkpoints keep
+ * @return int number of wallets copied
+ */
+int ledger_snapshot(const Ledger *ledger, LedgerEntry *out, int max, uint8_t stable);
+
+/**
+ * @brief copy the wallets in use of the ledger inside a segment of other processes
+ * @param name shm segment
+ * @param offset offset of the Ledger in the segment
+ * @param out wallets copied
+ * @param max size of out
+ * @return int number of wallets copied, -1 if the segment is not there
+ */
+int ledger_read(const char *name, size_t offset, LedgerEntry *out, int max);
+
+/**
+ * @brief name of a wallet for the reports: the pid for the wallet of a process, #ID for a stable one
+ * @param id wallet id
+ * @param name where it is written
+ * @param size size of name
+ */
+void ledger_name(uint32_t id, char *name, size_t size);
+
+#endif
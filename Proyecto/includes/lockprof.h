@@ -0,0 +1,83 @@
+/**
+ * @file lockprof.h
+ * @author Enmanuel, Jorge
+ * @brief Contention profiler for the process shared semaphores used as locks
+ * @version 0.1
+ * @date 2023-05-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every sem_wait/sem_post used as a lock goes through lockprof_wait and
+ * lockprof_post. Built with -DLOCKPROF (make LOCKPROF=1) they record, per
+ * call site of the wait, how long the caller waited for the lock and how
+ * long it held it, in histograms of a shared segment that every process
+ * adds to, plus the pid holding it right now. The histograms of a site are
+ * only written while its lock is held, so they keep a single writer.
+ * Without LOCKPROF they are plain sem_wait and sem_post.
+ *
+ * The segment outlives the processes, the lockprof tool ranks the sites.
+ */
+
+#ifndef _LOCKPROF_H
+#define _LOCKPROF_H
+
+#include <semaphore.h>
+#include "metrics.h"
+
+#define LOCKPROF_SHM "/lockprof_shm"
+#define LOCKPROF_SITES 64 // power of two
+#define LOCKPROF_FILE 40 // bytes of the file name kept
+#define LOCKPROF_HELD 8 // locks a process holds at the same time
+
+/**
+ * @brief statistics of one call site, times in ns
+ */
+typedef struct _lockSite{
+    uint32_t used; // 0 free, 1 being claimed, 2 in use
+    int line;
+    char file[LOCKPROF_FILE];
+    pid_t holder; // pid holding the lock taken here, 0 if released
+    uint64_t acquisitions;
+    uint64_t contended; // acquisitions that had to wait
+    Histogram wait;
+    Histogram hold;
+} __attribute__((aligned(CACHE_LINE))) LockSite;
+
+/**
+ * @brief LockProfile structure, this is the shared memory
+ */
+typedef struct _lockProfile{
+    LockSite sites[LOCKPROF_SITES];
+} LockProfile;
+
+/**
+ * @brief open the profile segment, creating it if it does not exist
+ * @param writable 1 for the processes that record, 0 for readers
+ * @return LockProfile* segment, NULL on error
+ */
+LockProfile *lockprof_attach(int writable);
+
+#ifdef LOCKPROF
+/**
+ * @brief sem_wait that records the wait in the site of the caller
+ * @param sem semaphore used as a lock
+ * @param file file of the call site
+ * @param line line of the call site
+ * @return int same as sem_wait
+ */
+int lockprof_wait_at(sem_t *sem, const char *file, int line);
+
+/**
+ * @brief sem_post that records the hold time in the site where the lock was taken
+ * @param sem semaphore used as a lock
+ * @return int same as sem_post
+ */
+int lockprof_post(sem_t *sem);
+#else
+#define lockprof_wait_at(sem, file, line) sem_wait(sem)
+#define lockprof_post(sem) sem_post(sem)
+#endif
+
+#define lockprof_wait(sem) lockprof_wait_at((sem), __FILE__, __LINE__)
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file metrics.h
+ * @author Enmanuel, Jorge
+ * @brief Metrics segment shared by the miners and read by minerstat
+ * @version 0.1
+ * @date 2023-05-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every counter has a single writer (a mining thread or the main thread of
+ * a miner) that updates it with relaxed atomic stores, so writers never
+ * wait and readers never lock. Thread counters are padded to a cache line
+ * so the threads of a miner do not share lines.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define METRICS_SHM "/benchpress_shm"
+#define METRICS_MAX_MINERS 100 // same as MAX_MINERS
+#define METRICS_MAX_THREADS 16
+#define METRICS_CHUNK 65536 // hashes between counter updates
+#define CACHE_LINE 64
+
+/* log-linear histogram: 8 sub-buckets per power of two, about 12% error */
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (40 * HIST_SUB) // microseconds up to 2^40
+
+/**
+ * @brief phases of a round, timed in microseconds
+ */
+typedef enum _phase{
+    PHASE_ROUND, // whole round
+    PHASE_MINE, // threads started to threads joined
+    PHASE_VOTE, // winner: waiting for the votes, loser: casting its vote
+    PHASE_COMMIT, // winner: register, MQ and rollover
+    PHASE_WAIT, // loser: waiting for the next round
+    NUM_PHASES
+} Phase;
+
+/**
+ * @brief counters of a mining thread, one cache line each
+ */
+typedef struct _threadCounters{
+    uint64_t hashes; // hashes computed
+    uint64_t chunks; // chunks completed, METRICS_CHUNK hashes unless the miner was tuned
+    uint64_t cancels; // times the thread stopped because a sibling found the solution
+} __attribute__((aligned(CACHE_LINE))) ThreadCounters;
+
+/**
+ * @brief HDR style histogram
+ */
+typedef struct _histogram{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+/**
+ * @brief metrics of one miner process
+ */
+typedef struct _minerMetrics{
+    pid_t pid; // owner of the slot, 0 if free
+    uint8_t nthreads; // threads in use
+    uint64_t start_ns; // when the slot was claimed
+    uint64_t rounds; // rounds mined
+    uint64_t wins; // rounds won
+    uint64_t mq_sent; // blocks sent to the monitor
+    uint64_t mq_dropped; // blocks thrown away because the MQ was full
+    uint64_t mq_coalesced; // pending blocks replaced by a newer one
+    uint64_t mq_spilled; // blocks kept locally because the MQ was full
+    uint64_t lock_wait; // ns waiting for the mutex of the system
+    ThreadCounters threads[METRICS_MAX_THREADS];
+    Histogram phases[NUM_PHASES];
+} __attribute__((aligned(CACHE_LINE))) MinerMetrics;
+
+/**
+ * @brief Metrics structure, this is the shared memory
+ */
+typedef struct _metrics{
+    MinerMetrics miners[METRICS_MAX_MINERS];
+} Metrics;
+
+/**
+ * @brief monotonic clock in nanoseconds
+ * @return uint64_t
+ */
+uint64_t now_ns();
+
+/**
+ * @brief open the metrics segment, creating it if it does not exist
+ * @return Metrics* segment, NULL on error
+ */
+Metrics *metrics_attach();
+
+/**
+ * @brief claim the slot of a miner process, slots of dead processes are reused
+ * @param metrics segment
+ * @param pid pid of the miner
+ * @param nthreads threads of the miner
+ * @return MinerMetrics* slot, NULL if there are none free
+ */
+MinerMetrics *metrics_claim(Metrics *metrics, pid_t pid, uint8_t nthreads);
+
+/**
+ * @brief free the slot of a miner
+ * @param slot slot claimed with metrics_claim
+ */
+void metrics_release(MinerMetrics *slot);
+
+/**
+ * @brief add to a counter that only the caller writes
+ * @param counter counter
+ * @param n amount to add
+ */
+void metrics_add(uint64_t *counter, uint64_t n);
+
+/**
+ * @brief record a value in a histogram that only the caller writes
+ * @param hist histogram
+ * @param value value to record
+ */
+void hist_record(Histogram *hist, uint64_t value);
+
+/**
+ * @brief bucket index of a value
+ * @param value value
+ * @return int index
+ */
+int hist_bucket(uint64_t value);
+
+/**
+ * @brief lowest value that falls in a bucket
+ * @param index bucket index
+ * @return uint64_t value
+ */
+uint64_t hist_bucket_value(int index);
+
+/**
+ * @brief percentile of a histogram
+ * @param hist histogram
+ * @param p percentile, between 0 and 100
+ * @return uint64_t value
+ */
+uint64_t hist_percentile(const Histogram *hist, double p);
+
+/**
+ * @brief add the contents of a histogram to another one
+ * @param dst histogram where the values are added
+ * @param src histogram read, with relaxed loads
+ */
+void hist_merge(Histogram *dst, const Histogram *src);
+
+#endif
@@ -9,6 +9,9 @@
  * 
  */
 
+#ifndef _MINER_H
+#define _MINER_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -25,11 +28,23 @@
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include "ledger.h"
+#include "metrics.h"
+#include "discovery.h"
+#include "lockprof.h"
+#include "tune.h"
 
 #define MAX_MINERS 100
 #define MAX_MSG 9
+#define SPILL_LENGTH 256 // blocks kept by the spill policy while the MQ is full
 #define MQ_NAME "/mq_facepulls"
 #define SYSTEM_SHM "/deadlift_shm"
+#define CHECKPOINT_FILE "deadlift.ckpt"
+#define CHECKPOINT_MAGIC "DLCKPT"
+#define CHECKPOINT_VERSION 2 // bumped whenever Checkpoint changes
+#define CHECKPOINT_EVERY 10 // blocks between checkpoints
+#define VOTE_POLL_NS 100000000 // the winner checks the votes every 0.1 seconds
+#define VOTE_POLLS 5 // and gives up waiting after this many checks
 
 /**
  * @brief Miner structure
@@ -37,6 +52,7 @@
 typedef struct _miner{
     pid_t pid; // pid of the miner
     short coins; // coins the miner owns
+    uint32_t wallet; // id of its wallet in the ledger
 } Miner;
 
 /**
@@ -46,6 +62,10 @@ typedef struct _minerData {
     long start;
     long end;
     long target;
+    PowSearch search; // kernel that hashes a chunk
+    long chunk; // hashes between checks of the stop flag
+    ThreadCounters *counters; // metrics of the thread
+    uint8_t thread; // 1 for the first thread, for the trace
 } MinerData;
 
 /**
@@ -60,6 +80,7 @@ typedef struct _block{
     uint8_t num_voters; // number of miners that have to vote for this block
     uint8_t total_votes; // total votes for this block
     uint8_t favorable_votes; // favorable votes for this block
+    uint64_t sent_ns; // when it was queued for the comprobador (now_ns), 0 if unknown
 } Block;
 
 #define SIZE sizeof(Block)
@@ -73,9 +94,45 @@ typedef struct _system{
     Block last_block; // last block mined
     Block current_block; // current block being mined
     sem_t mutex; // protection for shared memory
+    Ledger ledger; // authoritative wallets, updated without the mutex
     uint8_t monitor_up; // flag to check if the monitor is up
+    uint8_t head_valid; // last_block holds a committed or restored block
+    uint32_t ready; // set once create_system is done, futex word
 } System;
 
+/**
+ * @brief Checkpoint structure, snapshot of the chain head saved to disk
+ */
+typedef struct _checkpoint{
+    char magic[8]; // CHECKPOINT_MAGIC
+    uint32_t version; // CHECKPOINT_VERSION
+    uint32_t size; // sizeof(Checkpoint), catches a layout change without a new version
+    Block head; // last committed block
+    uint32_t num_wallets; // stable wallets in the ledger
+    LedgerEntry wallets[LEDGER_SIZE]; // ledger snapshot
+} Checkpoint;
+
+/**
+ * @brief what send_queue does with a block when the MQ is full
+ */
+typedef enum _mqPolicy{
+    MQ_DROP_OLDEST, // take the oldest message out of the queue
+    MQ_COALESCE, // keep only the latest block and send it when there is room
+    MQ_SPILL // keep up to SPILL_LENGTH blocks locally
+} MqPolicy;
+
+/**
+ * @brief Options passed to the miner after the mandatory arguments
+ */
+typedef struct _minerOptions{
+    uint8_t resume; // continue the chain from the checkpoint
+    char checkpoint[64]; // checkpoint file
+    MqPolicy mq_policy; // overflow policy of the monitor MQ
+    uint32_t wallet; // --wallet=ID, 0 for a wallet of this process only
+    uint8_t auto_tune; // NTHREADS auto, the configuration is calibrated
+    uint8_t retune; // calibrate even if there is a saved configuration
+} MinerOptions;
+
 /**
  * @brief initialize a new block
  * 
@@ -119,11 +176,90 @@ void _register(int pipe_read);
  * @param argv char**
  * @param n_sec uint8_t
  * @param nthreads uint8_t
+ * @param opts MinerOptions, optional flags
  */
-void check_args(int argc, char *argv[], uint8_t *n_sec, uint8_t *nthreads);
+void check_args(int argc, char *argv[], uint8_t *n_sec, uint8_t *nthreads, MinerOptions *opts);
 
 /**
  * @brief open memory segment for system, upload initial values
  * @return System* new system
  */
 System* create_system();
+
+/**
+ * @brief copy the chain head and the ledger into a checkpoint, the caller
+ * holds the mutex so both belong to the same block
+ * @param system System
+ * @param ckpt checkpoint to fill
+ */
+void take_checkpoint(System *system, Checkpoint *ckpt);
+
+/**
+ * @brief save a checkpoint to a file. The file is replaced atomically,
+ * a crash never leaves a half written checkpoint
+ * @param ckpt checkpoint taken with take_checkpoint
+ * @param path checkpoint file
+ * @return int 0 on success, -1 on error
+ */
+int save_checkpoint(const Checkpoint *ckpt, const char *path);
+
+/**
+ * @brief load a checkpoint from a file
+ * @param ckpt checkpoint where the file is loaded
+ * @param path checkpoint file
+ * @return int 0 on success, -1 if there is no checkpoint, -2 if the file
+ * is not a checkpoint of this version, the reason is printed
+ */
+int load_checkpoint(Checkpoint *ckpt, const char *path);
+
+/* Steps of a round, shared by the miner and the simulator. The caller holds
+   the mutex of the system and sends the signals. */
+
+/**
+ * @brief add a miner to the voters of a block
+ * @param block block being mined
+ * @param miner miner that mines it
+ */
+void round_join(Block *block, const Miner *miner);
+
+/**
+ * @brief publish the solution of the winner, who votes for itself
+ * @param block block being mined
+ * @param solution solution found by the winner
+ */
+void round_publish(Block *block, long solution);
+
+/**
+ * @brief vote for the solution published by the winner
+ * @param block block being mined
+ * @param solution solution found by the voter
+ */
+void round_vote(Block *block, long solution);
+
+/**
+ * @brief credit a wallet, sweeping the wallets of the processes that are
+ * gone when the ledger is full
+ * @param system System
+ * @param wallet wallet id
+ * @param delta coins to add
+ * @return int32_t new balance, -1 if the ledger is still full, the error is printed
+ */
+int32_t credit_wallet(System *system, uint32_t wallet, int32_t delta);
+
+/**
+ * @brief count the votes, pay the winner if the block was accepted and copy
+ * the wallets of the voters from the ledger into the block
+ * @param system System
+ * @param winner miner that published the solution
+ * @return uint8_t 1 if the block was accepted, 0 if not
+ */
+uint8_t round_close(System *system, Miner *winner);
+
+/**
+ * @brief commit the current block as the head of the chain and prepare the
+ * next one, whose target is the solution of the head
+ * @param system System
+ */
+void round_next(System *system);
+
+#endif
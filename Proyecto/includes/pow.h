@@ -23,4 +23,54 @@
  */
 long int pow_hash(long int x);
 
+/**
+ * @brief Computes pow_hash for a batch of arguments. The iterations are
+ * independent so they can overlap in the pipeline.
+ *
+ * @param x Arguments of the hash function.
+ * @param out Results, out[i] = pow_hash(x[i]).
+ * @param n Number of arguments.
+ */
+void pow_hash_batch(const long int *x, long int *out, int n);
+
+/**
+ * @brief Searches [start, end) for the first x with pow_hash(x) == target.
+ * Every kernel returns the same result, they only differ in how the hashes
+ * are computed.
+ */
+typedef long int (*PowSearch)(long int start, long int end, long int target);
+
+/**
+ * @brief A search kernel and its name.
+ */
+typedef struct _powKernel {
+  const char *name;
+  PowSearch search;
+} PowKernel;
+
+#define POW_NUM_KERNELS 4
+
+/**
+ * @brief The search kernels: "scalar" calls pow_hash for every x,
+ * "incremental" adds X modulo P from one x to the next, "barrett" replaces
+ * the division with a Barrett reduction and "simd" runs the incremental
+ * kernel on POW_SIMD_LANES consecutive x at once.
+ */
+extern const PowKernel pow_kernels[POW_NUM_KERNELS];
+
+#define POW_SIMD_LANES 8
+
+long int pow_search_scalar(long int start, long int end, long int target);
+long int pow_search_incremental(long int start, long int end, long int target);
+long int pow_search_barrett(long int start, long int end, long int target);
+long int pow_search_simd(long int start, long int end, long int target);
+
+/**
+ * @brief Finds a kernel by name.
+ *
+ * @param name Name of the kernel.
+ * @return The kernel, NULL if there is none with that name.
+ */
+const PowKernel *pow_kernel(const char *name);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+/**
+ * @file ring.h
+ * @author Enmanuel, Jorge
+ * @brief Lock-free broadcast ring between the comprobador and the monitors
+ * @version 0.2
+ * @date 2023-05-12
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Single producer, several subscribers, every subscriber sees every block.
+ * The producer owns writing and each subscriber owns its own cursor, each
+ * on its own cache line. A slot is published with a release store of
+ * writing and a subscriber frees it with a release store of its cursor.
+ *
+ * The producer is gated by the slowest subscriber, or in lossy mode only
+ * by itself: it overwrites the oldest slot and subscribers that fell
+ * behind skip ahead. A gating subscriber whose process is gone without
+ * unsubscribing (SIGKILL) is dropped after RING_LIVENESS_NS. Slots carry a version (seqlock) so an overwritten
+ * slot is detected instead of being read torn.
+ *
+ * Nobody blocks unless the ring is full or empty; then the side spins for
+ * a while and finally sleeps in a futex on the index it waits for. The
+ * spin budget adapts to how often spinning was enough.
+ *
+ * A subscriber can register a filter in its cursor. The producer runs the
+ * filters when it publishes a block and marks in the slot which
+ * subscribers take it, so the others skip the slot without copying it. A
+ * header only subscriber copies the block without the wallets.
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <signal.h>
+#include "miner.h"
+#include "discovery.h"
+
+#define BUFFER_LENGTH 16 // power of two, the indices wrap around
+#define SHM_NAME "/facepulls_shm"
+#define RING_MAX_SUBSCRIBERS 8
+#define RING_SPIN_MIN 64
+#define RING_SPIN_MAX 16384
+#define RING_FILTER_PIDS 8
+#define RING_LIVENESS_NS 200000000 // sleep of a full producer between checks of the slowest subscriber
+#define RING_REJECTED_ONLY 0x1 // filter flags
+#define RING_HEADER_ONLY 0x2
+
+/**
+ * @brief blocks a subscriber wants, every condition has to hold
+ */
+typedef struct _ringFilter{
+    uint32_t flags; // RING_REJECTED_ONLY, RING_HEADER_ONLY
+    uint32_t every; // only blocks whose sequence number is a multiple of every, 0 for all
+    uint32_t num_pids;
+    pid_t pids[RING_FILTER_PIDS]; // only blocks won by one of these, none for all
+} RingFilter;
+
+/**
+ * @brief index owned by one side of the ring
+ */
+typedef struct _ringCursor{
+    uint32_t seq; // next slot to write or read, futex word
+    uint32_t waiting; // the owner is (about to be) asleep in a futex
+    uint32_t spin; // spin budget of the owner
+    uint32_t active; // subscriber cursors: slot in use
+    uint32_t lost; // subscriber cursors: blocks overwritten before being read
+    pid_t pid; // subscriber cursors: owner process
+    RingFilter filter; // subscriber cursors: set before active becomes 1
+} __attribute__((aligned(CACHE_LINE))) RingCursor;
+
+/**
+ * @brief what the comprobador found out about a block
+ */
+typedef struct _blockInfo{
+    uint8_t verified; // 1 if pow_hash(solution) == target
+    uint8_t header_only; // set by a header only subscriber, the wallets were not copied
+} BlockInfo;
+
+/**
+ * @brief slot of the ring
+ */
+typedef struct _ringSlot{
+    uint32_t version; // 2 * (seq + 1) once the block of seq is complete, odd while written
+    uint32_t filtered; // subscribers the producer ran its filter for, one bit each
+    uint32_t match; // subscribers whose filter takes the block
+    BlockInfo info;
+    Block block;
+} RingSlot;
+
+/**
+ * @brief SharedMemory structure, segment shared by the comprobador and the monitors
+ */
+typedef struct _sharedMemory{
+    RingCursor writing; // written by the comprobador
+    RingCursor readers[RING_MAX_SUBSCRIBERS]; // one per monitor
+    uint32_t ready; // set once the ring is initialized
+    uint32_t lossy; // the producer does not wait for the subscribers
+    uint32_t using; // subscribers attached
+    uint64_t base; // sequence number of the first block of the ring, in the history
+    RingSlot slots[BUFFER_LENGTH];
+} SharedMemory;
+
+/**
+ * @brief initialize the ring of a new segment
+ * @param shmem segment
+ * @param lossy 1 if the producer must never wait for the subscribers
+ * @param base sequence number of the first block that will be published
+ */
+void ring_init(SharedMemory *shmem, uint8_t lossy, uint64_t base);
+
+/**
+ * @brief attach a subscriber, it will see the blocks published from now on
+ * @param shmem segment, already initialized (ready set)
+ * @param filter blocks the subscriber wants, NULL for all of them
+ * @return int subscriber id, -1 if there are no free cursors
+ */
+int ring_subscribe(SharedMemory *shmem, const RingFilter *filter);
+
+/**
+ * @brief detach a subscriber
+ * @param shmem segment
+ * @param sub subscriber id
+ */
+void ring_unsubscribe(SharedMemory *shmem, int sub);
+
+/**
+ * @brief publish a block, waiting while the slowest subscriber is a full ring behind
+ * @param shmem segment
+ * @param block block to publish
+ * @param info what the comprobador found out about the block
+ * @param stop the wait gives up when this becomes set
+ * @return int 0 on success, -1 if stopped
+ */
+int ring_push(SharedMemory *shmem, const Block *block, const BlockInfo *info, volatile sig_atomic_t *stop);
+
+/**
+ * @brief check a block against a filter
+ * @param filter filter
+ * @param block block, only its header is read
+ * @param seq sequence number of the block
+ * @return int 1 if the filter takes the block, 0 if not
+ */
+int ring_filter_match(const RingFilter *filter, const Block *block, uint64_t seq);
+
+/**
+ * @brief take the next block of a subscriber that its filter takes, waiting while there is none
+ * @param shmem segment
+ * @param sub subscriber id
+ * @param block where the block is copied
+ * @param info where the information about the block is copied
+ * @param stop the wait gives up when this becomes set
+ * @return int blocks lost (overwritten) before this one, -1 if stopped
+ */
+int ring_pop(SharedMemory *shmem, int sub, Block *block, BlockInfo *info, volatile sig_atomic_t *stop);
+
+/**
+ * @brief blocks a subscriber can take right now without waiting, only the
+ * ones its filter takes, the others ring_pop skips and then sleeps
+ * @param shmem segment
+ * @param sub subscriber id
+ * @return uint32_t number of blocks, a lossy ring counts the ones overwritten too
+ */
+uint32_t ring_available(SharedMemory *shmem, int sub);
+
+/**
+ * @brief sequence number of the next block a subscriber will take
+ * @param shmem segment
+ * @param sub subscriber id
+ * @return uint64_t sequence number, counted from base
+ */
+uint64_t ring_sequence(SharedMemory *shmem, int sub);
+
+#endif
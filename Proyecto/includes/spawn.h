@@ -0,0 +1,46 @@
+/**
+ * @file spawn.h
+ * @author Enmanuel, Jorge
+ * @brief Starting and stopping the miners and monitors of the headless tools
+ * @version 0.1
+ * @date 2023-06-03
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The harness and the churn run the real programs as children with their
+ * output thrown away. A monitor forks the comprobador, so it is started in
+ * a process group of its own and signaled as a whole, otherwise its child
+ * would survive it.
+ */
+
+#ifndef _SPAWN_H
+#define _SPAWN_H
+
+#include <sys/types.h>
+
+/**
+ * @brief sleep some milliseconds
+ * @param ms milliseconds
+ */
+void sleep_ms(long ms);
+
+/**
+ * @brief start a program with its output thrown away
+ * @param argv program and arguments
+ * @param group 1 to start it in a group of its own, signaled as a whole
+ * @return pid_t pid of the child, -1 on error
+ */
+pid_t spawn(char *const argv[], int group);
+
+/**
+ * @brief stop children with SIGINT and wait for them, SIGKILL for the ones
+ * still there after the grace time
+ * @param children pids, set to 0 once reaped, the ones <= 0 are skipped
+ * @param n children
+ * @param group 1 if they were started with a group of their own
+ * @param grace_s seconds they have to leave
+ * @param poll_ms time between two checks
+ */
+void stop_all(pid_t *children, int n, int group, int grace_s, long poll_ms);
+
+#endif
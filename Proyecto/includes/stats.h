@@ -0,0 +1,115 @@
+/**
+ * @file stats.h
+ * @author Enmanuel, Jorge
+ * @brief Rolling statistics of the blocks seen by a monitor
+ * @version 0.1
+ * @date 2023-05-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The monitor keeps the last window blocks in a ring. Adding a block
+ * updates every aggregate in O(1): the entry that leaves the window is
+ * subtracted (rejections, its winner, its round time and latency in the
+ * histograms) and the new one is added. Round times are the gaps between
+ * arrivals, latencies go from the moment the block was queued to its
+ * arrival.
+ * Nothing is sorted until a summary is rendered, once per frame.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "miner.h"
+#include "ring.h"
+
+#define STATS_WINDOW 1000 // default blocks in the window
+#define STATS_MAX_WINDOW 1000000
+#define STATS_MINUTE 60000000000ull // ns
+#define STATS_PIDS 256 // power of two, winners tracked in the window
+#define STATS_EWMA_ALPHA 0.125
+#define STATS_TOP 5 // rows of the rankings
+#define STATS_FPS 4 // default summary refresh rate
+#define STATS_SUMMARY_SIZE 4096
+
+/**
+ * @brief a block in the window
+ */
+typedef struct _statsEntry{
+    uint64_t arrival; // ns
+    uint64_t round; // us since the previous block, 0 for the first one
+    uint64_t latency; // us since the block was queued, 0 if unknown
+    pid_t winner;
+    uint8_t rejected; // by the votes
+    uint8_t invalid; // by the POW check of the comprobador
+} StatsEntry;
+
+/**
+ * @brief wins of a pid in the window
+ */
+typedef struct _winnerCount{
+    pid_t pid; // 0 if the slot was never used
+    uint32_t wins;
+} WinnerCount;
+
+/**
+ * @brief Stats structure, aggregates over the last window blocks
+ */
+typedef struct _stats{
+    uint32_t window; // capacity of entries
+    StatsEntry *entries; // ring, the block number modulo window
+    uint64_t head; // blocks seen since the start
+    uint64_t minute_tail; // oldest block of the window that arrived in the last minute
+    uint32_t rejected; // rejected blocks in the window
+    uint32_t invalid; // POW check failures in the window
+    uint64_t lost; // blocks the monitor never saw
+    double round_ewma; // us
+    Histogram rounds; // round times in the window, us
+    Histogram latency; // end to end latencies in the window, us
+    WinnerCount winners[STATS_PIDS]; // open addressing by pid
+    uint32_t used_winners; // slots of winners ever taken
+    Block last; // latest block, its wallets are the leaderboard
+} Stats;
+
+/**
+ * @brief initialize the statistics
+ * @param stats statistics
+ * @param window blocks kept, 0 for the default
+ * @return int 0 on success, -1 on error
+ */
+int stats_init(Stats *stats, uint32_t window);
+
+/**
+ * @brief free the statistics
+ * @param stats statistics
+ */
+void stats_free(Stats *stats);
+
+/**
+ * @brief account a new block in O(1)
+ * @param stats statistics
+ * @param block block
+ * @param info what the comprobador found out about the block
+ * @param now arrival time, ns
+ */
+void stats_add(Stats *stats, const Block *block, const BlockInfo *info, uint64_t now);
+
+/**
+ * @brief account blocks the monitor lost
+ * @param stats statistics
+ * @param lost number of blocks
+ */
+void stats_lost(Stats *stats, int lost);
+
+/**
+ * @brief render the summary
+ * @param stats statistics
+ * @param now current time, ns
+ * @param wallets snapshot of the ledger, the richest are shown
+ * @param num_wallets wallets in the snapshot
+ * @param buf where the summary is written
+ * @param size size of buf
+ * @return size_t length of the summary
+ */
+size_t stats_render(Stats *stats, uint64_t now, const LedgerEntry *wallets, int num_wallets, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * @file trace.h
+ * @author Enmanuel, Jorge
+ * @brief Per process trace rings of the phases of a round
+ * @version 0.1
+ * @date 2023-05-30
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every traced process owns a ring of the trace segment and appends begin
+ * and end events to it, stamped with the monotonic clock and the id of the
+ * block of the round, so the rings of several processes can be merged on a
+ * common time line. The segment is only created by the trace tool
+ * (trace --start); while it does not exist trace_open returns NULL and
+ * every trace call is a test of that pointer. The threads of a process
+ * share its ring, a slot is taken with an atomic add and marked valid once
+ * it is written. When a ring is full the oldest events are overwritten.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "metrics.h"
+
+#define TRACE_SHM "/trace_shm"
+#define TRACE_PROCS 256 // miners and monitor processes of a run
+#define TRACE_EVENTS 2048 // events per ring, power of two
+#define TRACE_ROLE 16
+
+/**
+ * @brief what an event marks
+ */
+typedef enum _traceName{
+    TRACE_TARGET, // target fetch
+    TRACE_JOIN, // voter registration
+    TRACE_THREADS, // mining threads started
+    TRACE_SCAN, // a thread searching its range
+    TRACE_BROADCAST, // winner: solution published and SIGUSR2 sent
+    TRACE_VOTE, // winner: waiting for the votes, loser: casting its vote
+    TRACE_REGISTER, // block written to the register
+    TRACE_MQ, // block sent to the monitor
+    TRACE_ROLLOVER, // next block created and SIGUSR1 sent
+    TRACE_WAIT, // loser: waiting for the next round
+    TRACE_RECEIVE, // comprobador: block taken from the MQ
+    TRACE_PUBLISH, // comprobador: verified block published
+    NUM_TRACE_NAMES
+} TraceName;
+
+/**
+ * @brief one event, seq is the position in the ring plus one once it is written
+ */
+typedef struct _traceEvent{
+    uint64_t ts; // ns, monotonic clock
+    uint32_t seq;
+    int32_t block; // id of the block of the round
+    uint16_t name; // TraceName
+    char ph; // 'B' begin, 'E' end, 'i' instant
+    uint8_t tid; // 0 main thread, 1.. mining threads
+} TraceEvent;
+
+/**
+ * @brief ring of a process
+ */
+typedef struct _traceRing{
+    pid_t pid; // owner, 0 if free
+    char role[TRACE_ROLE];
+    uint64_t head; // events ever appended
+    TraceEvent events[TRACE_EVENTS];
+} __attribute__((aligned(CACHE_LINE))) TraceRing;
+
+/**
+ * @brief TraceSegment structure, this is the shared memory
+ */
+typedef struct _traceSegment{
+    TraceRing rings[TRACE_PROCS];
+} TraceSegment;
+
+extern const char *trace_names[NUM_TRACE_NAMES];
+
+/**
+ * @brief open the trace segment
+ * @param create 1 to create it if it does not exist
+ * @param writable 0 for readers
+ * @return TraceSegment* segment, NULL if it does not exist or on error
+ */
+TraceSegment *trace_attach(int create, int writable);
+
+/**
+ * @brief claim a ring for the calling process, if tracing is on
+ * @param role shown as the name of the process
+ * @return TraceRing* ring, NULL if tracing is off or there are none free
+ */
+TraceRing *trace_open(const char *role);
+
+/**
+ * @brief append an event to a ring
+ * @param ring ring of the process
+ * @param name what happened
+ * @param ph 'B', 'E' or 'i'
+ * @param tid thread
+ * @param block id of the block of the round
+ */
+void trace_event(TraceRing *ring, TraceName name, char ph, uint8_t tid, int32_t block);
+
+#define trace_begin(ring, name, tid, block) do { if (ring) trace_event((ring), (name), 'B', (tid), (block)); } while (0)
+#define trace_end(ring, name, tid, block) do { if (ring) trace_event((ring), (name), 'E', (tid), (block)); } while (0)
+#define trace_instant(ring, name, tid, block) do { if (ring) trace_event((ring), (name), 'i', (tid), (block)); } while (0)
+
+/**
+ * @brief copy the valid events of a ring, oldest first
+ * @param ring ring, possibly still being written
+ * @param events where they are copied, room for TRACE_EVENTS
+ * @return int events copied
+ */
+int trace_snapshot(const TraceRing *ring, TraceEvent *events);
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file tune.h
+ * @author Enmanuel, Jorge
+ * @brief Calibration of the threads, search kernel and chunk size of a miner
+ * @version 0.1
+ * @date 2023-06-01
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * With NTHREADS auto the miner measures the hashrate of the configurations
+ * on the host as it is loaded right now, other miners included. First every
+ * kernel and chunk size on one thread, then the thread counts with the best
+ * of those. A configuration within TUNE_TIE of the best one wins if it uses
+ * smaller chunks or fewer threads: smaller chunks stop sooner when a sibling
+ * finds the solution, fewer threads leave the cores to the other miners.
+ *
+ * The result is saved in tune_<host>.txt and reused by the next miners of
+ * the host. While mining, the hashrate of every round is compared with the
+ * calibrated one and the miner calibrates again when it drifted more than
+ * TUNE_DRIFT for TUNE_DRIFT_ROUNDS rounds in a row.
+ */
+
+#ifndef _TUNE_H
+#define _TUNE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pow.h"
+
+#define TUNE_FILE "tune_%s.txt" // %s is the host name
+#define TUNE_SAMPLE_NS 20000000 // time a configuration is measured
+#define TUNE_NUM_CHUNKS 4
+#define TUNE_CHUNKS {4096, 16384, 65536, 262144}
+#define TUNE_TIE 0.02
+#define TUNE_DRIFT 0.25
+#define TUNE_DRIFT_ROUNDS 3
+#define TUNE_MIN_ROUND_NS 100000000 // shorter rounds are too noisy to compare
+
+/**
+ * @brief a configuration and its hashrate
+ */
+typedef struct _tuning{
+    uint8_t nthreads;
+    const PowKernel *kernel;
+    long chunk; // hashes searched between checks of the stop flag
+    double rate; // hashes/s of all the threads
+} Tuning;
+
+/**
+ * @brief measure the configurations and keep the best
+ * @param best where the best configuration is written
+ * @param max_threads most threads tried
+ */
+void tune_calibrate(Tuning *best, int max_threads);
+
+/**
+ * @brief name of the file of this host
+ * @param path where it is written
+ * @param size size of path
+ */
+void tune_path(char *path, size_t size);
+
+/**
+ * @brief read a saved configuration
+ * @param tuning where it is read
+ * @param path file
+ * @return int 0 on success, -1 if there is none or it is not valid
+ */
+int tune_load(Tuning *tuning, const char *path);
+
+/**
+ * @brief save a configuration, replacing the file at once
+ * @param tuning configuration
+ * @param path file
+ * @return int 0 on success, -1 on error
+ */
+int tune_save(const Tuning *tuning, const char *path);
+
+/**
+ * @brief compare the hashrate of a round with the calibrated one
+ * @param tuning calibrated configuration
+ * @param rate hashes/s of the round
+ * @param strikes rounds in a row that drifted, kept by the caller
+ * @return int 1 when it is time to calibrate again
+ */
+int tune_drifted(const Tuning *tuning, double rate, int *strikes);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file verify.h
+ * @author Enmanuel, Jorge
+ * @brief Verification stage of the comprobador
+ * @version 0.1
+ * @date 2023-05-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The comprobador submits the blocks it receives in batches. A pool of
+ * workers checks pow_hash(solution) == target on chunks of the batches
+ * with pow_hash_batch, without touching the ring, and a publisher thread
+ * hands the verified blocks to a sink in the order they were submitted.
+ * Several batches are in flight, so receiving, verifying and publishing
+ * overlap.
+ */
+
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+#include "miner.h"
+#include "ring.h"
+
+#define VERIFY_BATCH 64 // blocks per batch
+#define VERIFY_SLOTS 4 // batches in flight
+#define VERIFY_CHUNK 16 // blocks verified by a worker at a time
+
+/**
+ * @brief receives every verified block, in arrival order
+ */
+typedef void (*VerifySink)(const Block *block, const BlockInfo *info, void *arg);
+
+typedef struct _verifier Verifier;
+
+/**
+ * @brief start the worker pool and the publisher
+ * @param nthreads workers
+ * @param sink function called with every verified block
+ * @param arg argument for the sink
+ * @return Verifier* the stage, NULL on error
+ */
+Verifier *verifier_start(int nthreads, VerifySink sink, void *arg);
+
+/**
+ * @brief submit a batch of blocks, waits if every batch is in flight
+ * @param verifier stage
+ * @param blocks blocks received
+ * @param n number of blocks, at most VERIFY_BATCH
+ */
+void verifier_submit(Verifier *verifier, const Block *blocks, int n);
+
+/**
+ * @brief publish what was submitted, stop the threads and free the stage
+ * @param verifier stage
+ */
+void verifier_stop(Verifier *verifier);
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * @file chainverify_launch.c
+ * @author Enmanuel, Jorge
+ * @brief offline verifier for the chain logs written by the register
+ * @version 0.1
+ * @date 2023-05-04
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The log is mapped and split at its keyframes, each keyframe segment is
+ * decoded and verified by one of the threads. Links between consecutive
+ * blocks that fall on a segment boundary are checked after the join.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/pow.h"
+#include "../includes/chain.h"
+
+#define VERIFY_BATCH 256 // blocks hashed per call to pow_hash_batch
+#define MAX_REPORTED 10 // errors printed in detail
+
+/**
+ * @brief a keyframe-bounded run of records and what was found in it
+ */
+typedef struct _segment{
+    size_t begin; // offset of the keyframe
+    size_t end; // offset of the next keyframe
+    // boundary blocks, to check the links between segments
+    short first_id;
+    long first_target;
+    short last_id;
+    long last_solution;
+    // results
+    long blocks;
+    long bad_pow; // validated blocks whose solution does not hash to the target
+    long bad_reject; // rejected blocks whose solution was right
+    long bad_link; // target differs from the previous solution
+    long bad_votes; // vote counts or winner inconsistent with the result
+    long gaps; // missing ids (a register only logs the blocks its miner sent)
+    short first_error; // id of the first wrong block
+    uint8_t corrupt; // a record could not be decoded
+} Segment;
+
+typedef struct _verifier{
+    const uint8_t *map;
+    Segment *segments;
+    long num_segments;
+    long next; // next segment to verify, taken atomically
+} Verifier;
+
+/**
+ * @brief private function to mark the first wrong block of a segment
+ */
+static void flag_error(Segment *seg, long *counter, short id) {
+    if (seg->bad_pow + seg->bad_reject + seg->bad_link + seg->bad_votes == 0)
+        seg->first_error = id;
+    (*counter)++;
+}
+
+/**
+ * @brief private function that checks the votes and the winner of a block
+ * @return int 1 if consistent, 0 if not
+ */
+static int votes_consistent(const Block *block) {
+    uint8_t i;
+    if (block->favorable_votes > block->total_votes || block->total_votes > block->num_voters)
+        return 0;
+    if (block->favorable_votes != block->total_votes) // rejected, nobody gets the coin
+        return block->winner == 0;
+    for (i = 0; i < block->num_voters; i++)
+        if (block->miners[i].pid == block->winner)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief private function that hashes a batch of pending blocks and checks the results
+ */
+static void flush_batch(Segment *seg, long *solutions, long *targets, short *ids, uint8_t *validated, int n) {
+    long hashes[VERIFY_BATCH];
+    int i;
+    pow_hash_batch(solutions, hashes, n);
+    for (i = 0; i < n; i++) {
+        if (validated[i] && hashes[i] != targets[i])
+            flag_error(seg, &seg->bad_pow, ids[i]);
+        else if (!validated[i] && hashes[i] == targets[i])
+            flag_error(seg, &seg->bad_reject, ids[i]);
+    }
+}
+
+/**
+ * @brief private function that decodes and verifies one segment
+ */
+static void verify_segment(const uint8_t *map, Segment *seg) {
+    ChainCodec codec;
+    Block block;
+    long n, solutions[VERIFY_BATCH], targets[VERIFY_BATCH];
+    short ids[VERIFY_BATCH], prev_id = 0;
+    long prev_solution = 0;
+    uint8_t validated[VERIFY_BATCH];
+    size_t offset = seg->begin;
+    int pending = 0;
+
+    chain_codec_init(&codec, 0);
+    while (offset < seg->end) {
+        n = chain_decode(&codec, map + offset, seg->end - offset, &block);
+        if (n < 0) {
+            seg->corrupt = 1;
+            break;
+        }
+        offset += n;
+        if (seg->blocks == 0) {
+            seg->first_id = block.id;
+            seg->first_target = block.target;
+        } else if (block.id == (short)(prev_id + 1)) {
+            if (block.target != prev_solution)
+                flag_error(seg, &seg->bad_link, block.id);
+        } else {
+            seg->gaps++;
+        }
+        if (!votes_consistent(&block))
+            flag_error(seg, &seg->bad_votes, block.id);
+        solutions[pending] = block.solution;
+        targets[pending] = block.target;
+        ids[pending] = block.id;
+        validated[pending] = block.favorable_votes == block.total_votes;
+        if (++pending == VERIFY_BATCH) {
+            flush_batch(seg, solutions, targets, ids, validated, pending);
+            pending = 0;
+        }
+        prev_id = block.id;
+        prev_solution = block.solution;
+        seg->blocks++;
+    }
+    if (pending)
+        flush_batch(seg, solutions, targets, ids, validated, pending);
+    seg->last_id = prev_id;
+    seg->last_solution = prev_solution;
+}
+
+/**
+ * @brief private function that the verifier threads will execute
+ * @param args Verifier shared by all threads
+ * @return void*
+ */
+void *verify_work(void *args) {
+    Verifier *verifier = (Verifier*) args;
+    long i;
+    while ((i = __atomic_fetch_add(&verifier->next, 1, __ATOMIC_RELAXED)) < verifier->num_segments)
+        verify_segment(verifier->map, &verifier->segments[i]);
+    return NULL;
+}
+
+/**
+ * @brief private function that splits the log at its keyframes
+ * @return long number of segments, -1 on error
+ */
+static long split_segments(const uint8_t *map, size_t len, Segment **segments) {
+    long count = 0, capacity = 1024;
+    size_t offset = CHAIN_HEADER_SIZE;
+    long span;
+    Segment *aux;
+
+    *segments = malloc(capacity * sizeof(Segment));
+    if (*segments == NULL)
+        return -1;
+    offset = chain_next_keyframe(map, len, offset);
+    while (offset < len) {
+        if (count == capacity) {
+            capacity *= 2;
+            aux = realloc(*segments, capacity * sizeof(Segment));
+            if (aux == NULL) {
+                free(*segments);
+                return -1;
+            }
+            *segments = aux;
+        }
+        memset(&(*segments)[count], 0, sizeof(Segment));
+        (*segments)[count].begin = offset;
+        // the first record is the keyframe itself, start looking after it
+        span = chain_record_span(map + offset, len - offset, NULL);
+        offset = span < 0 ? len : chain_next_keyframe(map, len, offset + span);
+        (*segments)[count].end = offset;
+        count++;
+    }
+    return count;
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Main function for the chain verifier
+ * @return 0 if the chain is valid, 1 if not
+ */
+int main(int argc, char *argv[]) {
+    int fd;
+    long i, nthreads, num_segments, total = 0, gaps = 0;
+    long bad_pow = 0, bad_reject = 0, bad_link = 0, bad_votes = 0, corrupt = 0, reported = 0;
+    struct stat st;
+    uint8_t *map;
+    Segment *segments;
+    Verifier verifier;
+    pthread_t *threads;
+    struct timespec start;
+    double secs;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stdout, "Usage: %s <CHAIN_LOG> [NTHREADS]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    nthreads = argc == 3 ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0 || nthreads > 256) {
+        fprintf(stdout, "NTHREADS must be a value between 1 and 256\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((fd = open(argv[1], O_RDONLY)) == -1) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < CHAIN_HEADER_SIZE) {
+        fprintf(stdout, "%s is not a chain log\n", argv[1]);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    if (chain_read_header(map, st.st_size, NULL) == -1) {
+        fprintf(stdout, "%s is not a chain log\n", argv[1]);
+        munmap(map, st.st_size);
+        exit(EXIT_FAILURE);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((num_segments = split_segments(map, st.st_size, &segments)) == -1) {
+        perror("malloc segments");
+        munmap(map, st.st_size);
+        exit(EXIT_FAILURE);
+    }
+    if (nthreads > num_segments)
+        nthreads = num_segments ? num_segments : 1;
+    threads = (pthread_t*) malloc(nthreads * sizeof(pthread_t));
+    if (threads == NULL) {
+        perror("malloc threads");
+        free(segments);
+        munmap(map, st.st_size);
+        exit(EXIT_FAILURE);
+    }
+    verifier = (Verifier){ .map = map, .segments = segments, .num_segments = num_segments, .next = 0 };
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, verify_work, &verifier)) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    secs = elapsed(&start);
+
+    for (i = 0; i < num_segments; i++) {
+        Segment *seg = &segments[i];
+        // link with the last block of the previous segment
+        if (i > 0 && seg->blocks && segments[i - 1].blocks) {
+            if (seg->first_id != (short)(segments[i - 1].last_id + 1))
+                gaps++;
+            else if (seg->first_target != segments[i - 1].last_solution) {
+                bad_link++;
+                if (reported++ < MAX_REPORTED)
+                    fprintf(stdout, "block %04d: target does not match the previous solution\n", seg->first_id);
+            }
+        }
+        if (seg->bad_pow + seg->bad_reject + seg->bad_link + seg->bad_votes && reported++ < MAX_REPORTED)
+            fprintf(stdout, "block %04d: first error in segment at offset %zu\n", seg->first_error, seg->begin);
+        if (seg->corrupt) {
+            corrupt++;
+            fprintf(stdout, "segment at offset %zu: corrupt record\n", seg->begin);
+        }
+        total += seg->blocks;
+        gaps += seg->gaps;
+        bad_pow += seg->bad_pow;
+        bad_reject += seg->bad_reject;
+        bad_link += seg->bad_link;
+        bad_votes += seg->bad_votes;
+    }
+
+    fprintf(stdout, "Blocks:\t\t%ld (%ld segments, %ld threads)\n", total, num_segments, nthreads);
+    fprintf(stdout, "Invalid POW:\t%ld\nWrong reject:\t%ld\nBroken links:\t%ld\nBad votes:\t%ld\nGaps:\t\t%ld\n",
+                bad_pow, bad_reject, bad_link, bad_votes, gaps);
+    fprintf(stdout, "Time:\t\t%.3f s\t%.0f blocks/s\t%.1f MB/s\n",
+                secs, secs > 0 ? total / secs : 0, secs > 0 ? st.st_size / secs / 1e6 : 0);
+
+    free(threads);
+    free(segments);
+    munmap(map, st.st_size);
+    return (bad_pow + bad_reject + bad_link + bad_votes + corrupt) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/**
+ * @file churn_launch.c
+ * @author Enmanuel, Jorge
+ * @brief stress test: miners join and leave while the chain runs
+ * @version 0.1
+ * @date 2023-06-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Starts a monitor and M miners like the harness, then keeps starting new
+ * miners and stopping running ones at the given rates (events per second,
+ * the time between two events is uniform around the mean). A stopped miner
+ * leaves gracefully with SIGINT or, kill-pct % of the times, dies with
+ * SIGKILL in the middle of whatever it was doing. The number of miners is
+ * kept between min-miners and max-miners.
+ *
+ * The chain is watched from the system segment, read only: every new
+ * last_block is a committed block. A block with less favorable votes than
+ * votes is a lost round, one with less votes than voters made the winner
+ * wait for the vote timeout. A time longer than stall-ms without a new
+ * block is a stall, reported with the churn event that came last before
+ * it. When the miners leave the system segment can be unlinked and a new
+ * one created by the next miner, the watch moves to the new one and counts
+ * it as a new system.
+ *
+ * Every interval a row with the churn and the chain of that interval is
+ * printed, and appended to a CSV with --out. The summary goes at the end.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/ring.h"
+#include "../includes/spawn.h"
+
+#define CHURN_MAX_MINERS 64
+#define CHURN_POLL_MS 5
+#define CHURN_STAGGER_MS 20 // between the first miners, the first one creates the system
+#define CHURN_MONITOR_MS 100 // for the monitor to be waiting before the first miner
+#define CHURN_MAX_SECONDS 60 // what a miner accepts as NSECONDS
+#define CHURN_GRACE 5 // seconds a leaving miner has before SIGKILL
+
+volatile sig_atomic_t shutdown = 0;
+
+void signal_handler(int sig) {
+    shutdown = 1;
+}
+
+/**
+ * @brief state of a miner started by the churn
+ */
+typedef enum _minerState{
+    MINER_FREE,
+    MINER_LIVE,
+    MINER_LEAVING // SIGINT sent, not reaped yet
+} MinerState;
+
+typedef struct _child{
+    pid_t pid;
+    MinerState state;
+    uint64_t leave_ns; // when it was told to leave
+} Child;
+
+/**
+ * @brief the system segment being watched
+ */
+typedef struct _chainView{
+    System *system; // NULL until the first miner creates it
+    ino_t ino;
+    short last_id; // id of the last block seen, -1 if none
+} ChainView;
+
+/**
+ * @brief what happened in an interval, or in the whole run
+ */
+typedef struct _counts{
+    int joins;
+    int leaves; // graceful
+    int kills;
+    int exits; // miners that ended on their own, refused by a full system
+    uint64_t blocks;
+    uint64_t rejected; // lost rounds
+    uint64_t timeouts; // rounds where a voter never voted
+    int systems; // system segments created
+    uint64_t max_gap_ns;
+} Counts;
+
+/**
+ * @brief last churn event, blamed for the next stall
+ */
+typedef struct _event{
+    const char *what;
+    pid_t pid;
+    uint64_t ns;
+} Event;
+
+static Child children[CHURN_MAX_MINERS];
+static Event last_event = {"start", 0, 0};
+
+/**
+ * @brief private function, seconds of a uniform wait with the mean of the rate
+ */
+static double next_wait(double rate) {
+    return rate > 0 ? 2 * drand48() / rate : 1e9;
+}
+
+static int count_live() {
+    int i, n = 0;
+    for (i = 0; i < CHURN_MAX_MINERS; i++)
+        n += children[i].state == MINER_LIVE;
+    return n;
+}
+
+/**
+ * @brief private function that starts a miner in a free slot
+ * @return int 0 on success, -1 if there is no free slot or fork failed
+ */
+static int join(const char *miner_path, int seconds_left, const char *threads, uint64_t now, Counts *c) {
+    char duration[16];
+    int i;
+    for (i = 0; i < CHURN_MAX_MINERS && children[i].state != MINER_FREE; i++)
+        ;
+    if (i == CHURN_MAX_MINERS)
+        return -1;
+    // the miners would stop on their own after this, the churn stops them first
+    snprintf(duration, sizeof(duration), "%d", seconds_left + CHURN_GRACE > CHURN_MAX_SECONDS ?
+                CHURN_MAX_SECONDS : seconds_left + CHURN_GRACE);
+    if ((children[i].pid = spawn((char *const[]){(char*)miner_path, duration, (char*)threads, NULL}, 0)) == -1) {
+        perror("fork");
+        return -1;
+    }
+    children[i].state = MINER_LIVE;
+    c->joins++;
+    last_event = (Event){"join", children[i].pid, now};
+    return 0;
+}
+
+/**
+ * @brief private function that stops a random live miner
+ */
+static void leave(int kill_pct, uint64_t now, Counts *c) {
+    int i, n = count_live(), pick;
+    if (n == 0)
+        return;
+    pick = drand48() * n;
+    for (i = 0; i < CHURN_MAX_MINERS; i++) {
+        if (children[i].state != MINER_LIVE || pick-- > 0)
+            continue;
+        if (drand48() * 100 < kill_pct) {
+            kill(children[i].pid, SIGKILL);
+            c->kills++;
+            last_event = (Event){"kill", children[i].pid, now};
+        } else {
+            kill(children[i].pid, SIGINT);
+            c->leaves++;
+            last_event = (Event){"leave", children[i].pid, now};
+        }
+        children[i].state = MINER_LEAVING;
+        children[i].leave_ns = now;
+        return;
+    }
+}
+
+/**
+ * @brief private function that reaps the miners that are gone, SIGKILL for the ones late to leave
+ */
+static void reap(uint64_t now, Counts *c) {
+    pid_t pid;
+    int i;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        for (i = 0; i < CHURN_MAX_MINERS && children[i].pid != pid; i++)
+            ;
+        if (i == CHURN_MAX_MINERS)
+            continue; // the monitor
+        if (children[i].state == MINER_LIVE)
+            c->exits++;
+        children[i].state = MINER_FREE;
+        children[i].pid = 0;
+    }
+    for (i = 0; i < CHURN_MAX_MINERS; i++)
+        if (children[i].state == MINER_LEAVING && now - children[i].leave_ns > CHURN_GRACE * 1000000000ull)
+            kill(children[i].pid, SIGKILL);
+}
+
+/**
+ * @brief private function that maps the system segment again if a new one was created
+ * @return int 1 if it is a new system
+ */
+static int view_refresh(ChainView *view) {
+    struct stat st;
+    System *system;
+    int fd = shm_open(SYSTEM_SHM, O_RDONLY, 0);
+    if (fd == -1) // gone, the old mapping still shows its miners
+        return 0;
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(System) || st.st_ino == view->ino) {
+        close(fd);
+        return 0;
+    }
+    system = mmap(NULL, sizeof(System), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (system == MAP_FAILED)
+        return 0;
+    if (view->system)
+        munmap(view->system, sizeof(System));
+    view->system = system;
+    view->ino = st.st_ino;
+    view->last_id = -1;
+    return 1;
+}
+
+/**
+ * @brief private function that looks for new committed blocks
+ * @param view watched system
+ * @param block where the last one is copied
+ * @return int blocks committed since the last call
+ */
+static int view_poll(ChainView *view, Block *block) {
+    short id;
+    int n;
+    if (view->system == NULL || !__atomic_load_n(&view->system->head_valid, __ATOMIC_ACQUIRE))
+        return 0;
+    id = __atomic_load_n(&view->system->last_block.id, __ATOMIC_ACQUIRE);
+    if (id == view->last_id)
+        return 0;
+    // copied without the mutex, a block that changed while copied is read on the next poll
+    *block = view->system->last_block;
+    if (__atomic_load_n(&view->system->last_block.id, __ATOMIC_ACQUIRE) != id || block->id != id)
+        return 0;
+    n = view->last_id == -1 ? 1 : (short)(id - view->last_id);
+    view->last_id = id;
+    return n > 0 ? n : 1;
+}
+
+static void add_counts(Counts *total, const Counts *c) {
+    total->joins += c->joins;
+    total->leaves += c->leaves;
+    total->kills += c->kills;
+    total->exits += c->exits;
+    total->blocks += c->blocks;
+    total->rejected += c->rejected;
+    total->timeouts += c->timeouts;
+    total->systems += c->systems;
+    if (c->max_gap_ns > total->max_gap_ns)
+        total->max_gap_ns = c->max_gap_ns;
+}
+
+/**
+ * @brief private function that prints the row of an interval, and appends it to the CSV
+ */
+static void write_row(FILE *csv, double t, int live, const Counts *c, uint8_t stalled) {
+    fprintf(stdout, "%7.1f %6d %6d %6d %6d %6d %7lu %8lu %8lu %8d %10.0f %8s\n", t, live, c->joins, c->leaves,
+                c->kills, c->exits, (unsigned long)c->blocks, (unsigned long)c->rejected, (unsigned long)c->timeouts,
+                c->systems, c->max_gap_ns / 1e6, stalled ? "STALL" : "");
+    if (csv)
+        fprintf(csv, "%.1f,%d,%d,%d,%d,%d,%lu,%lu,%lu,%d,%.0f,%d\n", t, live, c->joins, c->leaves, c->kills,
+                    c->exits, (unsigned long)c->blocks, (unsigned long)c->rejected, (unsigned long)c->timeouts,
+                    c->systems, c->max_gap_ns / 1e6, stalled);
+}
+
+/**
+ * @brief private function that stops the miners and then the monitor, and waits for them
+ */
+static void stop_children(pid_t monitor) {
+    pid_t miners[CHURN_MAX_MINERS];
+    int i, n = 0;
+    for (i = 0; i < CHURN_MAX_MINERS; i++) {
+        if (children[i].state != MINER_FREE)
+            miners[n++] = children[i].pid;
+        children[i].state = MINER_FREE;
+    }
+    stop_all(miners, n, 0, CHURN_GRACE, CHURN_POLL_MS);
+    stop_all(&monitor, 1, 1, CHURN_GRACE, CHURN_POLL_MS);
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--miners=M] [--threads=T|auto] [--seconds=S] [--join-rate=R] [--leave-rate=R]\n"
+                    "       [--kill-pct=P] [--min-miners=N] [--max-miners=N] [--interval=MS] [--stall-ms=MS]\n"
+                    "       [--seed=N] [--out=FILE] [--bin=DIR]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for churn
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    int i, fd, miners = 3, seconds = 20, kill_pct = 50, min_miners = 1, max_miners = 8, n, live, stalls = 0;
+    long interval_ms = 1000, stall_ms = 2000, seed = 1;
+    double join_rate = 0.5, leave_rate = 0.5;
+    char *out = NULL, bin[256] = ".", miner_path[300], monitor_path[300], threads[8] = "2", *slash;
+    uint64_t start, now, deadline, next_join, next_leave, next_row, last_block_ns, stall_ns = 0, longest = 0;
+    uint8_t in_stall = 0, stalled = 0;
+    pid_t monitor;
+    ChainView view = {NULL, 0, -1};
+    Counts interval, total;
+    Histogram gaps; // us between blocks
+    Block block;
+    struct sigaction act;
+    struct stat st;
+    FILE *csv = NULL;
+
+    if ((slash = strrchr(argv[0], '/')) != NULL) // the other programs are next to this one
+        snprintf(bin, sizeof(bin), "%.*s", (int)(slash - argv[0]), argv[0]);
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--miners=", 9) && (miners = atoi(argv[i] + 9)) > 0 && miners <= CHURN_MAX_MINERS)
+            continue;
+        else if (!strcmp(argv[i], "--threads=auto") || (!strncmp(argv[i], "--threads=", 10)
+                    && atoi(argv[i] + 10) > 0 && atoi(argv[i] + 10) <= METRICS_MAX_THREADS))
+            snprintf(threads, sizeof(threads), "%s", argv[i] + 10);
+        else if (!strncmp(argv[i], "--seconds=", 10) && (seconds = atoi(argv[i] + 10)) > 0
+                    && seconds <= CHURN_MAX_SECONDS - CHURN_GRACE)
+            continue;
+        else if (!strncmp(argv[i], "--join-rate=", 12) && (join_rate = atof(argv[i] + 12)) >= 0)
+            continue;
+        else if (!strncmp(argv[i], "--leave-rate=", 13) && (leave_rate = atof(argv[i] + 13)) >= 0)
+            continue;
+        else if (!strncmp(argv[i], "--kill-pct=", 11) && (kill_pct = atoi(argv[i] + 11)) >= 0 && kill_pct <= 100)
+            continue;
+        else if (!strncmp(argv[i], "--min-miners=", 13) && (min_miners = atoi(argv[i] + 13)) >= 0)
+            continue;
+        else if (!strncmp(argv[i], "--max-miners=", 13) && (max_miners = atoi(argv[i] + 13)) > 0
+                    && max_miners <= CHURN_MAX_MINERS)
+            continue;
+        else if (!strncmp(argv[i], "--interval=", 11) && (interval_ms = atol(argv[i] + 11)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--stall-ms=", 11) && (stall_ms = atol(argv[i] + 11)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--seed=", 7))
+            seed = atol(argv[i] + 7);
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else if (!strncmp(argv[i], "--bin=", 6))
+            snprintf(bin, sizeof(bin), "%s", argv[i] + 6);
+        else
+            usage(argv[0]);
+    }
+    if (min_miners > max_miners || miners > max_miners)
+        usage(argv[0]);
+    if ((fd = shm_open(SYSTEM_SHM, O_RDONLY, 0)) != -1 || (fd = shm_open(SHM_NAME, O_RDONLY, 0)) != -1) {
+        close(fd);
+        fprintf(stdout, "miners or a monitor are already running\n");
+        exit(EXIT_FAILURE);
+    }
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGINT, &act, NULL) < 0 || sigaction(SIGTERM, &act, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if (out) {
+        n = stat(out, &st) == -1 || st.st_size == 0;
+        if ((csv = fopen(out, "a")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        if (n)
+            fprintf(csv, "time_s,miners,joins,leaves,kills,exits,blocks,rejected,vote_timeouts,new_systems,max_gap_ms,stall\n");
+    }
+    srand48(seed);
+    snprintf(miner_path, sizeof(miner_path), "%s/miner", bin);
+    snprintf(monitor_path, sizeof(monitor_path), "%s/monitor", bin);
+
+    memset(children, 0, sizeof(children));
+    memset(&interval, 0, sizeof(Counts));
+    memset(&total, 0, sizeof(Counts));
+    memset(&gaps, 0, sizeof(Histogram));
+    // the monitor forks, its group is stopped
+    monitor = spawn((char *const[]){monitor_path, "--summary=1", NULL}, 1);
+    sleep_ms(CHURN_MONITOR_MS);
+    for (i = 0; i < miners && !shutdown; i++) {
+        join(miner_path, seconds, threads, now_ns(), &interval);
+        sleep_ms(CHURN_STAGGER_MS);
+    }
+
+    fprintf(stdout, "%7s %6s %6s %6s %6s %6s %7s %8s %8s %8s %10s\n", "time_s", "miners", "joins", "leaves", "kills",
+                "exits", "blocks", "rejected", "timeouts", "systems", "max_gap_ms");
+    start = last_block_ns = now = now_ns();
+    deadline = start + seconds * 1000000000ull;
+    next_join = start + next_wait(join_rate) * 1e9;
+    next_leave = start + next_wait(leave_rate) * 1e9;
+    next_row = start + interval_ms * 1000000ull;
+    while (!shutdown && now < deadline) {
+        sleep_ms(CHURN_POLL_MS);
+        now = now_ns();
+        reap(now, &interval);
+        live = count_live();
+        if (now >= next_join) {
+            if (live < max_miners)
+                join(miner_path, (deadline - now) / 1000000000ull + 1, threads, now, &interval);
+            next_join = now + next_wait(join_rate) * 1e9;
+        }
+        if (now >= next_leave) {
+            if (live > min_miners)
+                leave(kill_pct, now, &interval);
+            next_leave = now + next_wait(leave_rate) * 1e9;
+        }
+        interval.systems += view_refresh(&view);
+        if ((n = view_poll(&view, &block)) > 0) {
+            interval.blocks += n;
+            interval.rejected += block.favorable_votes != block.total_votes;
+            interval.timeouts += block.total_votes < block.num_voters;
+            hist_record(&gaps, (now - last_block_ns) / 1000);
+            if (now - last_block_ns > interval.max_gap_ns)
+                interval.max_gap_ns = now - last_block_ns;
+            if (in_stall) {
+                fprintf(stdout, "stall of %.2f s from %.2f s, last event before it: %s %d at %.2f s\n",
+                            (now - last_block_ns) / 1e9, (last_block_ns - start) / 1e9,
+                            last_event.what, last_event.pid, last_event.ns > start ? (last_event.ns - start) / 1e9 : 0);
+                stall_ns += now - last_block_ns;
+                if (now - last_block_ns > longest)
+                    longest = now - last_block_ns;
+                in_stall = 0;
+            }
+            last_block_ns = now;
+        } else if (!in_stall && now - last_block_ns > stall_ms * 1000000ull) {
+            in_stall = stalled = 1;
+            stalls++;
+        }
+        if (now >= next_row) {
+            if (now - last_block_ns > interval.max_gap_ns) // the gap still open
+                interval.max_gap_ns = now - last_block_ns;
+            write_row(csv, (now - start) / 1e9, count_live(), &interval, stalled);
+            add_counts(&total, &interval);
+            memset(&interval, 0, sizeof(Counts));
+            stalled = in_stall;
+            next_row += interval_ms * 1000000ull;
+        }
+    }
+    if (in_stall) { // still stalled at the end
+        fprintf(stdout, "stall of %.2f s until the end, last event before it: %s %d at %.2f s\n",
+                    (now - last_block_ns) / 1e9, last_event.what, last_event.pid,
+                    last_event.ns > start ? (last_event.ns - start) / 1e9 : 0);
+        stall_ns += now - last_block_ns;
+        if (now - last_block_ns > longest)
+            longest = now - last_block_ns;
+    }
+    add_counts(&total, &interval);
+
+    stop_children(monitor);
+    if (view.system)
+        munmap(view.system, sizeof(System));
+    shm_unlink(SYSTEM_SHM);
+    shm_unlink(SHM_NAME);
+    shm_unlink(METRICS_SHM);
+    mq_unlink(MQ_NAME);
+    if (csv)
+        fclose(csv);
+
+    fprintf(stdout, "\n%.1f s, %d joins, %d leaves, %d kills, %d exits, %d systems\n", (now - start) / 1e9,
+                total.joins, total.leaves, total.kills, total.exits, total.systems);
+    fprintf(stdout, "%lu blocks, %.3f blocks/s, %lu lost rounds, %lu vote timeouts\n", (unsigned long)total.blocks,
+                total.blocks / ((now - start) / 1e9), (unsigned long)total.rejected, (unsigned long)total.timeouts);
+    fprintf(stdout, "gap between blocks p50 %.0f ms, p99 %.0f ms, max %.0f ms\n", hist_percentile(&gaps, 50) / 1e3,
+                hist_percentile(&gaps, 99) / 1e3, gaps.max / 1e3);
+    fprintf(stdout, "%d stalls longer than %ld ms, %.2f s stalled, longest %.2f s\n", stalls, stall_ms,
+                stall_ns / 1e9, longest / 1e9);
+    return 0;
+}
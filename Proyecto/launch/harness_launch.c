@@ -0,0 +1,240 @@
+/**
+ * @file harness_launch.c
+ * @author Enmanuel, Jorge
+ * @brief headless end to end benchmark: miners, monitor and a report
+ * @version 0.1
+ * @date 2023-05-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Starts a monitor and M miners with T threads each, without terminals,
+ * lets them run for a number of seconds or until a number of blocks has
+ * been committed, and reads the result from the metrics segment while the
+ * miners are still alive: blocks/s, hashes/s and the percentiles of the
+ * round phases. CPU usage comes from the rusage of the children. Then
+ * everything is stopped with SIGINT and the shm segments and the MQ are
+ * removed. The report is appended to a CSV or JSON Lines file, so several
+ * runs accumulate in the same file.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/ring.h"
+#include "../includes/spawn.h"
+#include <sys/resource.h>
+
+#define HARNESS_MAX_MINERS 64
+#define HARNESS_POLL_MS 20
+#define HARNESS_STAGGER_MS 20 // between miner starts, the first one creates the system
+#define HARNESS_MONITOR_MS 100 // for the monitor to be waiting before the first miner
+#define HARNESS_MAX_SECONDS 60 // what a miner accepts as NSECONDS
+#define HARNESS_GRACE 5 // seconds to wait for the children after SIGINT
+
+static const char *phase_names[NUM_PHASES] = {"round", "mine", "vote", "commit", "wait"};
+
+volatile sig_atomic_t shutdown = 0;
+
+void signal_handler(int sig) {
+    shutdown = 1;
+}
+
+/**
+ * @brief what a run measured
+ */
+typedef struct _report{
+    int miners;
+    int threads;
+    double seconds; // wall time measured
+    uint64_t blocks; // committed blocks (rounds won)
+    uint64_t rounds; // rounds of all the miners
+    uint64_t hashes;
+    double cpu; // CPU seconds of all the children
+    uint64_t lock_wait; // ns the miners waited for the mutex of the system
+    Histogram phases[NUM_PHASES];
+} Report;
+
+/**
+ * @brief private function that adds up the metrics of the given miners
+ */
+static void collect(const Metrics *metrics, const pid_t *miners, int num_miners, Report *report) {
+    int i, j, p;
+    pid_t pid;
+    report->blocks = report->rounds = report->hashes = report->lock_wait = 0;
+    memset(report->phases, 0, sizeof(report->phases));
+    for (i = 0; i < METRICS_MAX_MINERS; i++) {
+        const MinerMetrics *slot = &metrics->miners[i];
+        pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        for (j = 0; j < num_miners && miners[j] != pid; j++)
+            ;
+        if (pid == 0 || j == num_miners || __atomic_load_n(&slot->start_ns, __ATOMIC_ACQUIRE) == 0)
+            continue;
+        report->blocks += __atomic_load_n(&slot->wins, __ATOMIC_RELAXED);
+        report->rounds += __atomic_load_n(&slot->rounds, __ATOMIC_RELAXED);
+        report->lock_wait += __atomic_load_n(&slot->lock_wait, __ATOMIC_RELAXED);
+        for (j = 0; j < METRICS_MAX_THREADS; j++)
+            report->hashes += __atomic_load_n(&slot->threads[j].hashes, __ATOMIC_RELAXED);
+        for (p = 0; p < NUM_PHASES; p++)
+            hist_merge(&report->phases[p], &slot->phases[p]);
+    }
+}
+
+/**
+ * @brief private function, % of the time of the miners spent waiting for the mutex
+ */
+static double lock_share(const Report *r) {
+    return 100 * r->lock_wait / (r->seconds * 1e9 * r->miners);
+}
+
+/**
+ * @brief private function that appends the report to a file, or prints it
+ */
+static void write_report(const Report *r, const char *path, uint8_t json) {
+    FILE *file = stdout;
+    int p, header = 0;
+    struct stat st;
+
+    if (path) {
+        header = stat(path, &st) == -1 || st.st_size == 0;
+        if ((file = fopen(path, "a")) == NULL) {
+            perror("fopen");
+            return;
+        }
+    } else {
+        header = 1;
+    }
+    if (json) {
+        fprintf(file, "{\"miners\":%d,\"threads\":%d,\"seconds\":%.3f,\"blocks\":%lu,\"blocks_per_sec\":%.3f,"
+                      "\"rounds\":%lu,\"hashes_per_sec\":%.0f,\"cpu_pct\":%.1f,\"lock_wait_pct\":%.3f", r->miners, r->threads,
+                    r->seconds, (unsigned long)r->blocks, r->blocks / r->seconds, (unsigned long)r->rounds,
+                    r->hashes / r->seconds, 100 * r->cpu / r->seconds, lock_share(r));
+        for (p = 0; p < NUM_PHASES; p++)
+            fprintf(file, ",\"%s_us\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu}", phase_names[p],
+                        (unsigned long)hist_percentile(&r->phases[p], 50), (unsigned long)hist_percentile(&r->phases[p], 90),
+                        (unsigned long)hist_percentile(&r->phases[p], 99), (unsigned long)r->phases[p].max);
+        fprintf(file, "}\n");
+    } else {
+        if (header) {
+            fprintf(file, "miners,threads,seconds,blocks,blocks_per_sec,rounds,hashes_per_sec,cpu_pct,lock_wait_pct");
+            for (p = 0; p < NUM_PHASES; p++)
+                fprintf(file, ",%s_p50_us,%s_p90_us,%s_p99_us,%s_max_us", phase_names[p], phase_names[p],
+                            phase_names[p], phase_names[p]);
+            fprintf(file, "\n");
+        }
+        fprintf(file, "%d,%d,%.3f,%lu,%.3f,%lu,%.0f,%.1f,%.3f", r->miners, r->threads, r->seconds,
+                    (unsigned long)r->blocks, r->blocks / r->seconds, (unsigned long)r->rounds, r->hashes / r->seconds,
+                    100 * r->cpu / r->seconds, lock_share(r));
+        for (p = 0; p < NUM_PHASES; p++)
+            fprintf(file, ",%lu,%lu,%lu,%lu", (unsigned long)hist_percentile(&r->phases[p], 50),
+                        (unsigned long)hist_percentile(&r->phases[p], 90), (unsigned long)hist_percentile(&r->phases[p], 99),
+                        (unsigned long)r->phases[p].max);
+        fprintf(file, "\n");
+    }
+    if (file != stdout)
+        fclose(file);
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--miners=M] [--threads=T] [--seconds=S | --blocks=N]\n"
+                    "       [--out=FILE] [--format=csv|json] [--bin=DIR]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for the harness
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    int i, fd, miners = 3, threads = 2, seconds = 10;
+    long blocks = 0;
+    uint8_t json = 0;
+    char *out = NULL, bin[256] = ".", miner_path[300], monitor_path[300], duration[16], nthreads[8];
+    pid_t children[HARNESS_MAX_MINERS + 1];
+    Metrics *metrics;
+    Report report;
+    struct rusage usage_children;
+    struct sigaction act;
+    uint64_t start, deadline;
+    char *slash;
+
+    if ((slash = strrchr(argv[0], '/')) != NULL) // the other programs are next to this one
+        snprintf(bin, sizeof(bin), "%.*s", (int)(slash - argv[0]), argv[0]);
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--miners=", 9) && (miners = atoi(argv[i] + 9)) > 0 && miners <= HARNESS_MAX_MINERS)
+            continue;
+        else if (!strncmp(argv[i], "--threads=", 10) && (threads = atoi(argv[i] + 10)) > 0 && threads <= METRICS_MAX_THREADS)
+            continue;
+        else if (!strncmp(argv[i], "--seconds=", 10) && (seconds = atoi(argv[i] + 10)) > 0 && seconds <= HARNESS_MAX_SECONDS)
+            continue;
+        else if (!strncmp(argv[i], "--blocks=", 9) && (blocks = atol(argv[i] + 9)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else if (!strcmp(argv[i], "--format=json") || !strcmp(argv[i], "--format=csv"))
+            json = argv[i][9] == 'j';
+        else if (!strncmp(argv[i], "--bin=", 6))
+            snprintf(bin, sizeof(bin), "%s", argv[i] + 6);
+        else
+            usage(argv[0]);
+    }
+    if ((fd = shm_open(SYSTEM_SHM, O_RDONLY, 0)) != -1 || (fd = shm_open(SHM_NAME, O_RDONLY, 0)) != -1) {
+        close(fd);
+        fprintf(stdout, "miners or a monitor are already running\n");
+        exit(EXIT_FAILURE);
+    }
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGINT, &act, NULL) < 0 || sigaction(SIGTERM, &act, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    // created here, so it is still mapped when the last miner unlinks it
+    if ((metrics = metrics_attach()) == NULL)
+        exit(EXIT_FAILURE);
+
+    snprintf(miner_path, sizeof(miner_path), "%s/miner", bin);
+    snprintf(monitor_path, sizeof(monitor_path), "%s/monitor", bin);
+    // the miners would stop on their own after this, the harness stops them first
+    snprintf(duration, sizeof(duration), "%d", blocks || seconds + HARNESS_GRACE > HARNESS_MAX_SECONDS ?
+                HARNESS_MAX_SECONDS : seconds + HARNESS_GRACE);
+    snprintf(nthreads, sizeof(nthreads), "%d", threads);
+    memset(children, 0, sizeof(children));
+    // the monitor forks, its group is stopped
+    children[0] = spawn((char *const[]){monitor_path, "--summary=1", NULL}, 1);
+    sleep_ms(HARNESS_MONITOR_MS);
+    for (i = 1; i <= miners && !shutdown; i++) {
+        if ((children[i] = spawn((char *const[]){miner_path, duration, nthreads, NULL}, 0)) == -1) {
+            perror("fork");
+            break;
+        }
+        sleep_ms(HARNESS_STAGGER_MS);
+    }
+
+    start = now_ns();
+    // in blocks mode the miners stop on their own at HARNESS_MAX_SECONDS
+    deadline = start + (uint64_t)(blocks ? HARNESS_MAX_SECONDS : seconds) * 1000000000ull;
+    memset(&report, 0, sizeof(Report));
+    while (!shutdown && now_ns() < deadline) {
+        sleep_ms(HARNESS_POLL_MS);
+        collect(metrics, children + 1, miners, &report);
+        if (blocks && report.blocks >= blocks)
+            break;
+    }
+    report.seconds = (now_ns() - start) / 1e9;
+    report.miners = miners;
+    report.threads = threads;
+
+    stop_all(children + 1, miners, 0, HARNESS_GRACE, HARNESS_POLL_MS); // the miners first, so the monitor sees every block
+    stop_all(children, 1, 1, HARNESS_GRACE, HARNESS_POLL_MS);
+    getrusage(RUSAGE_CHILDREN, &usage_children);
+    report.cpu = usage_children.ru_utime.tv_sec + usage_children.ru_utime.tv_usec / 1e6 +
+                usage_children.ru_stime.tv_sec + usage_children.ru_stime.tv_usec / 1e6;
+
+    shm_unlink(SYSTEM_SHM);
+    shm_unlink(SHM_NAME);
+    shm_unlink(METRICS_SHM);
+    mq_unlink(MQ_NAME);
+    munmap(metrics, sizeof(Metrics));
+
+    write_report(&report, out, json);
+    return 0;
+}
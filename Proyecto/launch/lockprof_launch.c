@@ -0,0 +1,97 @@
+/**
+ * @file lockprof_launch.c
+ * @author Enmanuel, Jorge
+ * @brief ranks the critical sections recorded by the lock profiler
+ * @version 0.1
+ * @date 2023-05-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Reads the profile segment written by the miners and the monitor when
+ * they are built with make LOCKPROF=1 and prints one row per call site
+ * that took a lock, ranked by the total time spent waiting for it, the
+ * total time holding it or the acquisitions. The holder column is the pid
+ * that has the lock right now. The segment keeps adding up across runs
+ * until it is reset.
+ */
+
+#include "../includes/miner.h"
+
+typedef enum _sortKey{
+    SORT_WAIT,
+    SORT_HOLD,
+    SORT_COUNT
+} SortKey;
+
+static SortKey sort_key = SORT_WAIT;
+
+static uint64_t key(const LockSite *site) {
+    return sort_key == SORT_WAIT ? site->wait.sum : sort_key == SORT_HOLD ? site->hold.sum : site->acquisitions;
+}
+
+static int by_key(const void *a, const void *b) {
+    uint64_t x = key(*(const LockSite**)a), y = key(*(const LockSite**)b);
+    return (x < y) - (x > y); // descending
+}
+
+/**
+ * @brief Main function for lockprof
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    const LockSite *sites[LOCKPROF_SITES];
+    static LockSite copy[LOCKPROF_SITES];
+    LockProfile *profile;
+    char where[LOCKPROF_FILE + 16];
+    int i, n = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sort=wait"))
+            sort_key = SORT_WAIT;
+        else if (!strcmp(argv[i], "--sort=hold"))
+            sort_key = SORT_HOLD;
+        else if (!strcmp(argv[i], "--sort=count"))
+            sort_key = SORT_COUNT;
+        else if (!strcmp(argv[i], "--reset")) {
+            if (shm_unlink(LOCKPROF_SHM) == -1 && errno != ENOENT) {
+                perror("shm_unlink");
+                exit(EXIT_FAILURE);
+            }
+            return 0;
+        }
+        else {
+            fprintf(stdout, "Usage: %s [--sort=wait|hold|count] [--reset]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((profile = lockprof_attach(0)) == NULL) {
+        fprintf(stdout, "no lock profile, build with make LOCKPROF=1 and run the miners\n");
+        exit(EXIT_FAILURE);
+    }
+    // copied once, the processes may still be writing
+    for (i = 0; i < LOCKPROF_SITES; i++) {
+        if (__atomic_load_n(&profile->sites[i].used, __ATOMIC_ACQUIRE) != 2)
+            continue;
+        copy[n] = profile->sites[i];
+        sites[n] = &copy[n];
+        n++;
+    }
+    munmap(profile, sizeof(LockProfile));
+    qsort(sites, n, sizeof(sites[0]), by_key);
+
+    fprintf(stdout, "%-28s %9s %6s %10s %9s %9s %9s %10s %9s %9s %9s %8s\n", "site", "acquired", "cont%",
+                "wait ms", "w p50us", "w p99us", "w max us", "hold ms", "h p50us", "h p99us", "h max us", "holder");
+    for (i = 0; i < n; i++) {
+        snprintf(where, sizeof(where), "%s:%d", sites[i]->file, sites[i]->line);
+        fprintf(stdout, "%-28s %9lu %6.1f %10.3f %9.1f %9.1f %9.1f %10.3f %9.1f %9.1f %9.1f %8d\n", where,
+                    (unsigned long)sites[i]->acquisitions,
+                    sites[i]->acquisitions ? 100.0 * sites[i]->contended / sites[i]->acquisitions : 0,
+                    sites[i]->wait.sum / 1e6, hist_percentile(&sites[i]->wait, 50) / 1e3,
+                    hist_percentile(&sites[i]->wait, 99) / 1e3, sites[i]->wait.max / 1e3,
+                    sites[i]->hold.sum / 1e6, hist_percentile(&sites[i]->hold, 50) / 1e3,
+                    hist_percentile(&sites[i]->hold, 99) / 1e3, sites[i]->hold.max / 1e3, sites[i]->holder);
+    }
+    if (n == 0)
+        fprintf(stdout, "no lock taken yet\n");
+    return 0;
+}
@@ -9,14 +9,21 @@
 
 #include "../includes/miner.h"
 #include "../includes/pow.h"
+#include "../includes/trace.h"
 
 volatile sig_atomic_t sigusr2_received = 0; // indicates SIGUSR2 reception
 volatile sig_atomic_t sigusr1_received = 0; // indicates SIGUSR1 reception
 volatile sig_atomic_t magic_flag = 0; // indicates mining solution was found
 volatile sig_atomic_t shutdown = 0; // indicates system has to shutdown
 mqd_t mq = -2; // message queue
+mqd_t mq_drain = -2; // read end of the queue, used to drop the oldest message
 struct mq_attr attr; // message queue attributes
+Block pending[SPILL_LENGTH]; // blocks waiting for room in the queue
+int pending_head = 0, pending_count = 0;
 long _solution = 0; // solution to the target
+MinerMetrics local_metrics; // used when the metrics segment is not available
+TraceRing *trace = NULL; // ring of this miner, NULL if tracing is off
+int32_t round_id = 0; // block of the current round, for the trace
 
 /**
  * @brief interruption-safe sem_wait
@@ -30,6 +37,21 @@ int _sem_wait_safe(sem_t *sem) {
   return 0;
 }
 
+/**
+ * @brief waits for the mutex of the system, the time spent waiting goes to the metrics
+ * @param system System
+ * @param stats metrics of this miner
+ * @param file call site, for the lock profiler
+ * @param line call site, for the lock profiler
+ */
+void lock_system_at(System *system, MinerMetrics *stats, const char *file, int line){
+    uint64_t t = now_ns();
+    lockprof_wait_at(&(system->mutex), file, line);
+    metrics_add(&(stats->lock_wait), now_ns() - t);
+}
+
+#define lock_system(system, stats) lock_system_at((system), (stats), __FILE__, __LINE__)
+
 /**
  * @brief private function to handle signals
  * @param sig signal received
@@ -57,28 +79,80 @@ void signal_handler(int sig) {
  * @return void* 
  */
 void *work(void* args){
-    long i, result;
+    long result, chunk, chunk_end;
     MinerData *miner_data = (MinerData*) args;
-    for(i = miner_data->start; i < miner_data->end; i++){
-        if(magic_flag)
+    ThreadCounters *counters = miner_data->counters;
+    trace_begin(trace, TRACE_SCAN, miner_data->thread, round_id);
+    // the kernel searches a chunk at a time, the flag and the counters are checked between chunks
+    for(chunk = miner_data->start; chunk < miner_data->end; chunk = chunk_end){
+        if(magic_flag){
+            metrics_add(&counters->cancels, 1);
+            trace_end(trace, TRACE_SCAN, miner_data->thread, round_id);
             return NULL;
-        
-        result = pow_hash(i);
-        if(result == miner_data->target){
-            _solution = i;
+        }
+        chunk_end = chunk + miner_data->chunk < miner_data->end ? chunk + miner_data->chunk : miner_data->end;
+        result = miner_data->search(chunk, chunk_end, miner_data->target);
+        if(result != -1){
+            _solution = result;
             magic_flag = 1;
+            metrics_add(&counters->hashes, result - chunk + 1);
+            trace_end(trace, TRACE_SCAN, miner_data->thread, round_id);
             return NULL;
         }
+        metrics_add(&counters->hashes, chunk_end - chunk);
+        metrics_add(&counters->chunks, 1);
     }
+    trace_end(trace, TRACE_SCAN, miner_data->thread, round_id);
     return NULL;
 }
 
+/**
+ * @brief private function that keeps a block for later, the policy decides what is kept
+ * @param _block
+ * @param policy MQ_COALESCE or MQ_SPILL
+ * @param stats metrics of this miner
+ */
+void keep_pending(Block *_block, MqPolicy policy, MinerMetrics *stats){
+    int capacity = policy == MQ_SPILL ? SPILL_LENGTH : 1;
+    if(pending_count == capacity){ // forget the oldest one
+        pending_head = (pending_head + 1) % SPILL_LENGTH;
+        pending_count--;
+        metrics_add(policy == MQ_SPILL ? &(stats->mq_dropped) : &(stats->mq_coalesced), 1);
+    }
+    pending[(pending_head + pending_count) % SPILL_LENGTH] = *_block;
+    pending_count++;
+    if(policy == MQ_SPILL)
+        metrics_add(&(stats->mq_spilled), 1);
+}
+
+/**
+ * @brief sends the blocks kept while the queue was full, as long as there is room
+ * @param stats metrics of this miner
+ */
+void flush_queue(MinerMetrics *stats){
+    while(pending_count > 0 && mq != -2){
+        if(mq_send(mq, (char*)&pending[pending_head], sizeof(Block), 2) == -1){
+            if(errno != EAGAIN)
+                perror("mq_send");
+            return;
+        }
+        metrics_add(&(stats->mq_sent), 1);
+        pending_head = (pending_head + 1) % SPILL_LENGTH;
+        pending_count--;
+    }
+}
+
 /**
  * @brief checks for the existance of a message queue. if it exists, send Block
- * if it does not, do nothing
+ * if it does not, do nothing. The queue is non blocking, when it is full the
+ * policy decides which blocks are lost, the miner never waits for the monitor
  * @param _block 
+ * @param policy overflow policy
+ * @param stats metrics of this miner
  */
-void send_queue(Block *_block){
+void send_queue(Block *_block, MqPolicy policy, MinerMetrics *stats){
+    Block oldest;
+    _block->sent_ns = now_ns(); // the monitor measures the latency from here
     if(mq == -2) { // queue needs to be initialized again or for the first time
         // Initialize the queue attributes
         attr = (struct mq_attr){
@@ -88,16 +162,67 @@ void send_queue(Block *_block){
             .mq_curmsgs = 0
         };
         // Open the message queue
-        if((mq = mq_open(MQ_NAME, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR, &attr)) == (mqd_t) -1){
+        if((mq = mq_open(MQ_NAME, O_CREAT | O_WRONLY | O_NONBLOCK, S_IRUSR | S_IWUSR, &attr)) == (mqd_t) -1){
             perror("mq_open");
+            mq = -2;
             return;
         }
     }
+    flush_queue(stats);
+    if(pending_count > 0){ // older blocks go first
+        keep_pending(_block, policy, stats);
+        return;
+    }
     // send message
-    if(mq_send(mq, (char*)_block, sizeof(Block), 2) == -1) {
+    if(mq_send(mq, (char*)_block, sizeof(Block), 2) == 0){
+        metrics_add(&(stats->mq_sent), 1);
+        return;
+    }
+    if(errno != EAGAIN){
         perror("mq_send");
         return;
     }
+    if(policy != MQ_DROP_OLDEST){
+        keep_pending(_block, policy, stats);
+        return;
+    }
+    // drop the oldest message to make room for this one
+    if(mq_drain == -2 && (mq_drain = mq_open(MQ_NAME, O_RDONLY | O_NONBLOCK)) == (mqd_t) -1)
+        mq_drain = -2;
+    if(mq_drain != -2 && mq_receive(mq_drain, (char*)&oldest, SIZE, NULL) != -1)
+        metrics_add(&(stats->mq_dropped), 1);
+    if(mq_send(mq, (char*)_block, sizeof(Block), 2) == 0)
+        metrics_add(&(stats->mq_sent), 1);
+    else
+        metrics_add(&(stats->mq_dropped), 1);
+}
+
+/**
+ * @brief forgets the queue, it will be opened again when the monitor is back
+ */
+void close_queue(){
+    if(mq != -2)
+        mq_close(mq);
+    if(mq_drain != -2)
+        mq_close(mq_drain);
+    mq = mq_drain = -2;
+}
+
+/**
+ * @brief calibrates again after the hashrate drifted, between two rounds
+ * @param tuning configuration, replaced by the new one
+ * @param max_threads most threads tried
+ * @param tune_file file of this host
+ * @param stats metrics of this miner
+ * @return uint8_t threads of the new configuration
+ */
+uint8_t retune(Tuning *tuning, int max_threads, const char *tune_file, MinerMetrics *stats){
+    printf("\nminer %d hashrate drifted, calibrating again...\n", getpid());
+    tune_calibrate(tuning, max_threads);
+    if(tune_save(tuning, tune_file) == -1)
+        perror("tune_save");
+    stats->nthreads = tuning->nthreads;
+    return tuning->nthreads;
 }
 
 /**
@@ -111,11 +236,46 @@ int main(int argc, char *argv[]){
     int miner2register[2], ret = -2, fd_shm;
     long target = 0;
     struct sigaction act;
-    sigset_t a, old_a;
+    sigset_t a, old_a, usr1;
     struct timespec sleep_time;
     System *system; // structure representing the shared memory
+    MinerOptions opts;
+    Metrics *metrics;
+    MinerMetrics *stats; // this miner's slot in the metrics segment
+    uint64_t t_round, t_phase;
+    Checkpoint ckpt; // chain head and ledger, copied under the mutex
+    Block closed; // block of the round this miner won, copied under the mutex
+    uint8_t checkpoint_due = 0;
+    int resumable = -1; // 0 if there is a checkpoint to resume from
+    Tuning tuning; // threads, kernel and chunk size
+    char tune_file[96];
+    uint64_t t_mine, round_hashes;
+    int drift_strikes = 0, max_threads;
+    uint8_t retune_due = 0;
 
-    check_args(argc, argv, &n_sec, &nthreads);
+    check_args(argc, argv, &n_sec, &nthreads, &opts);
+    // checked before joining, a checkpoint that cannot be read must not start a new chain
+    if(opts.resume && (resumable = load_checkpoint(&ckpt, opts.checkpoint)) == -2){
+        fprintf(stderr, "move it away to start a new chain, or resume with a miner of its version\n");
+        exit(EXIT_FAILURE);
+    }
+    max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN) < METRICS_MAX_THREADS ? 2 * sysconf(_SC_NPROCESSORS_ONLN) : METRICS_MAX_THREADS;
+    if(opts.auto_tune){
+        tune_path(tune_file, sizeof(tune_file));
+        if(opts.retune || tune_load(&tuning, tune_file) == -1){
+            printf("\ncalibrating the miner on this host...\n");
+            tune_calibrate(&tuning, max_threads);
+            if(tune_save(&tuning, tune_file) == -1)
+                perror("tune_save");
+        }
+        if(tuning.nthreads > max_threads) // saved on the same host with other cpus online
+            tuning.nthreads = max_threads;
+        nthreads = tuning.nthreads;
+        printf("\n%d threads, %s kernel, chunks of %ld, %.0f hashes/s\n", nthreads, tuning.kernel->name,
+                    tuning.chunk, tuning.rate);
+        fflush(stdout); // not copied into the register
+    } else // the search of pow_hash, one by one
+        tuning = (Tuning){nthreads, pow_kernel("scalar"), METRICS_CHUNK, 0};
 
     if(pipe(miner2register) < 0){
         perror("pipe");
@@ -140,6 +300,12 @@ int main(int argc, char *argv[]){
         // create shared memory and initialize system
         system = create_system();
     } else { // shm exists
+        // the first miner may not have sized it yet, sleep until it has
+        close(fd_shm);
+        if((fd_shm = wait_for_shm(SYSTEM_SHM, O_RDWR, sizeof(System), &shutdown)) == -1){
+            perror("shm_open");
+            exit(EXIT_FAILURE);
+        }
         // mapping of the memory segment
         system = mmap(NULL, sizeof(System), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
         close(fd_shm);
@@ -148,6 +314,7 @@ int main(int argc, char *argv[]){
             shm_unlink(SYSTEM_SHM);
             exit(EXIT_FAILURE);
         }
+        wait_ready(&(system->ready), &shutdown); // and until its semaphore is initialized
         if(system->num_miners == MAX_MINERS){
             printf("\nsystem doesn't accept more miners\n");
             shm_unlink(SYSTEM_SHM);
@@ -181,36 +348,65 @@ int main(int argc, char *argv[]){
     // log new miner representing this process into system
     Miner this_miner; 
     this_miner.pid = getpid();
-    this_miner.coins = 0;
+    // a stable wallet is found again after a restart, the one of a process is not
+    this_miner.wallet = opts.wallet ? opts.wallet : LEDGER_PID_WALLET(this_miner.pid);
 
-    sem_wait(&(system->mutex));
+    lockprof_wait(&(system->mutex));
     /* ----------- Protected ----------- */
+    if(!opts.wallet) // left by a killed miner with the same pid
+        ledger_remove(&(system->ledger), this_miner.wallet);
+    if((this_miner.coins = credit_wallet(system, this_miner.wallet, 0)) == -1)
+        this_miner.coins = 0; // mines unpaid until a wallet is freed
     system->miners[system->num_miners] = this_miner;
     system->num_miners++;
-    sem_post(&(system->mutex));
+    lockprof_post(&(system->mutex));
     /* ------------- end prot --------------- */
     printf("\nminer %d registered\n", this_miner.pid);
+    if((metrics = metrics_attach()) == NULL || (stats = metrics_claim(metrics, this_miner.pid, nthreads)) == NULL){
+        stats = &local_metrics;
+        stats->nthreads = nthreads;
+    }
+    trace = trace_open("miner");
     // remove SIGUSR1 from auxiliar mask, for whenever this miner needs to be suspended
     sigfillset(&a);
     sigdelset(&a, SIGUSR1);
     sigdelset(&a, SIGINT);
     sigdelset(&a, SIGALRM);
+    sigemptyset(&usr1); // blocked while calibrating again
+    sigaddset(&usr1, SIGUSR1);
     // sigemptyset(&a);
     // sigaddset(&a, SIGUSR1);
 
     // FIRST ROUND MANAGEMENT
     if(first_miner_flag == 1){
         Block first_block;
-        init_block(&first_block, -1, 0); // initialize first block ever
-        sem_wait(&(system->mutex));
+        uint8_t resumed = 0;
+        uint32_t w;
+        if(opts.resume && resumable == 0){
+            init_block(&first_block, ckpt.head.id, ckpt.head.solution); // continue after the saved head
+            for(w = 0; w < ckpt.num_wallets; w++) // restore the wallets
+                ledger_credit(&(system->ledger), ckpt.wallets[w].id, ckpt.wallets[w].coins);
+            this_miner.coins = ledger_balance(&(system->ledger), this_miner.wallet);
+            printf("\nresuming chain from block %04d, %u wallets restored\n", ckpt.head.id, ckpt.num_wallets);
+            resumed = 1;
+        } else {
+            if(opts.resume)
+                printf("\nno checkpoint in %s, starting a new chain\n", opts.checkpoint);
+            init_block(&first_block, -1, 0); // initialize first block ever
+        }
+        lock_system(system, stats);
         /* ----------- Protected ----------- */
+        if(resumed){
+            system->last_block = ckpt.head;
+            system->head_valid = 1;
+        }
         system->current_block = first_block; // first block ready to get mined
         // send sigusr1 to all miners except this one, trigger start of first round
         for(i = 0; i < system->num_miners; i++){
             if(system->miners[i].pid != this_miner.pid)
                 kill(system->miners[i].pid, SIGUSR1);
         }
-        sem_post(&(system->mutex));
+        lockprof_post(&(system->mutex));
         /* ------------- end prot --------------- */        
     } else{
         // sigprocmask(SIG_BLOCK, &a, &old_a); // block SIGUSR1
@@ -226,7 +422,8 @@ int main(int argc, char *argv[]){
     }
         
     // allocate memory for threads
-    threads = (pthread_t*) malloc(nthreads * sizeof(pthread_t));
+    // with auto the threads may change while mining
+    threads = (pthread_t*) malloc((opts.auto_tune ? METRICS_MAX_THREADS : nthreads) * sizeof(pthread_t));
     if(threads == NULL){
         perror("malloc threads");
         sem_destroy(&(system->mutex));
@@ -234,7 +431,7 @@ int main(int argc, char *argv[]){
     }
     // unblock SIGUSR2, which is used to start voting
     sigdelset(&(act.sa_mask), SIGUSR2);
-    MinerData *miner_data = (MinerData*) malloc(sizeof(MinerData)*nthreads);
+    MinerData *miner_data = (MinerData*) malloc(sizeof(MinerData)*(opts.auto_tune ? METRICS_MAX_THREADS : nthreads));
     if(miner_data == NULL){
         perror("malloc minerData");
         free(threads);
@@ -243,22 +440,37 @@ int main(int argc, char *argv[]){
     }
     // initialitation ended, time to start mining
     while(!shutdown){
+        t_round = now_ns();
+        if(pending_count > 0) // the monitor may have caught up
+            flush_queue(stats);
         sigusr2_received = 0;
         magic_flag = 0;
         // get this rounds target
+        round_id = system->current_block.id;
+        trace_begin(trace, TRACE_TARGET, 0, round_id);
         target = system->current_block.target;
+        trace_end(trace, TRACE_TARGET, 0, round_id);
         // this miner will mine current block, so it's a voter
-        sem_wait(&(system->mutex));
+        trace_begin(trace, TRACE_JOIN, 0, round_id);
+        lock_system(system, stats);
         /* ----------- Protected ----------- */
-        system->current_block.miners[system->current_block.num_voters] = this_miner;
-        system->current_block.num_voters++;
-        sem_post(&(system->mutex));
+        round_join(&(system->current_block), &this_miner);
+        lockprof_post(&(system->mutex));
         /* ------------- end prot --------------- */
+        trace_end(trace, TRACE_JOIN, 0, round_id);
         // start mining
+        trace_begin(trace, TRACE_THREADS, 0, round_id);
+        t_mine = now_ns();
+        for(j = 0, round_hashes = 0; j < nthreads; j++)
+            round_hashes -= stats->threads[j].hashes;
         for(j = 0; j < nthreads; j++){
             miner_data[j].start = j * ((POW_LIMIT -1 ) / nthreads);
             miner_data[j].end = (j+1) * ((POW_LIMIT -1 ) / nthreads);
             miner_data[j].target = target;
+            miner_data[j].search = tuning.kernel->search;
+            miner_data[j].chunk = tuning.chunk;
+            miner_data[j].counters = &(stats->threads[j]);
+            miner_data[j].thread = j + 1;
             if(pthread_create(&threads[j], NULL, work, &miner_data[j])){
                 perror("pthread_create");
                 free(miner_data);
@@ -267,6 +479,7 @@ int main(int argc, char *argv[]){
                 exit(EXIT_FAILURE);
             }
         }
+        trace_end(trace, TRACE_THREADS, 0, round_id);
         for(j = 0; j < nthreads; j++){
             if(pthread_join(threads[j], NULL)){
                 perror("pthread_join");
@@ -276,26 +489,35 @@ int main(int argc, char *argv[]){
                 exit(EXIT_FAILURE);
             }
         }
+        hist_record(&(stats->phases[PHASE_MINE]), (now_ns() - t_round) / 1000);
+        // compare the hashrate of the round with the calibrated one
+        for(j = 0; j < nthreads; j++)
+            round_hashes += stats->threads[j].hashes;
+        if(opts.auto_tune && now_ns() - t_mine >= TUNE_MIN_ROUND_NS
+                    && tune_drifted(&tuning, round_hashes * 1e9 / (now_ns() - t_mine), &drift_strikes))
+            retune_due = 1;
+        metrics_add(&(stats->rounds), 1);
+        t_phase = now_ns();
         // check if this dude is the first to finish
         if(sigusr2_received == 0){ // WINNER WINNER CHICKEN DINNER
-            sem_wait(&(system->mutex));
+            trace_begin(trace, TRACE_BROADCAST, 0, round_id);
+            lock_system(system, stats);
             /* ----------- Protected ----------- */
-            // publish solution
-            system->current_block.solution = _solution; 
+            // publish solution, this miner votes for itself
+            round_publish(&(system->current_block), _solution);
             // send SIGUSR2 to all miners in mined block except this one, triggering start of voting
             for(i = 0; i < system->current_block.num_voters; i++){
                 if(system->current_block.miners[i].pid != this_miner.pid)
                     kill(system->current_block.miners[i].pid, SIGUSR2);
             }
-            // this miner votes for itself
-            system->current_block.total_votes++;
-            system->current_block.favorable_votes++;
-            sem_post(&(system->mutex));
+            lockprof_post(&(system->mutex));
             /* ------------- end prot --------------- */
+            trace_end(trace, TRACE_BROADCAST, 0, round_id);
+            trace_begin(trace, TRACE_VOTE, 0, round_id);
             sleep_time.tv_sec = 0;
-            sleep_time.tv_nsec = 100000000; // 0.1 seconds
+            sleep_time.tv_nsec = VOTE_POLL_NS; // 0.1 seconds
             // wait until all miners have voted
-            while(system->current_block.total_votes != system->current_block.num_voters && _voting != 5){
+            while(system->current_block.total_votes != system->current_block.num_voters && _voting != VOTE_POLLS){
                 ret = nanosleep(&sleep_time, NULL);
                 if(ret == -1){
                     free(miner_data);
@@ -309,13 +531,20 @@ int main(int argc, char *argv[]){
                 _voting++;
             }
             _voting = 0; // reset voting counter
+            hist_record(&(stats->phases[PHASE_VOTE]), (now_ns() - t_phase) / 1000);
+            t_phase = now_ns();
             // when voting is done, check if the solution got accepted
-            if(system->current_block.total_votes == system->current_block.favorable_votes){
-                system->current_block.winner = this_miner.pid;
-                this_miner.coins++;
-            }
+            lock_system(system, stats);
+            /* ----------- Protected ----------- */
+            if(round_close(system, &this_miner)) // may create or sweep wallets, and a late voter may still vote
+                metrics_add(&(stats->wins), 1);
+            closed = system->current_block; // sent from the copy, outside the lock
+            lockprof_post(&(system->mutex));
+            /* ------------- end prot --------------- */
+            trace_end(trace, TRACE_VOTE, 0, round_id);
             // send block to register and monitor
-            ret = write(miner2register[1], &(system->current_block), sizeof(Block));
+            trace_begin(trace, TRACE_REGISTER, 0, round_id);
+            ret = write(miner2register[1], &closed, sizeof(Block));
             if(ret < 0){
                 perror("write");
                 sem_destroy(&(system->mutex));
@@ -323,56 +552,96 @@ int main(int argc, char *argv[]){
                 free(threads);
                 exit(EXIT_FAILURE);
             }
+            trace_end(trace, TRACE_REGISTER, 0, round_id);
+            trace_begin(trace, TRACE_MQ, 0, round_id);
             if(system->monitor_up == 1) // check if monitor is up
-                send_queue(&(system->current_block));
-            else mq = -2;
+                send_queue(&closed, opts.mq_policy, stats);
+            else close_queue();
+            trace_end(trace, TRACE_MQ, 0, round_id);
             // set last block to current block and start again
-            sem_wait(&(system->mutex));
+            trace_begin(trace, TRACE_ROLLOVER, 0, round_id);
+            lock_system(system, stats);
             /* ----------- Protected ----------- */
-            system->last_block = system->current_block; // update System
-            Block new_block; // create new block for the next round
-            init_block(&new_block, system->last_block.id, system->last_block.solution);
-            system->current_block = new_block;
+            round_next(system); // update System, create new block for the next round
+            if((checkpoint_due = system->last_block.id % CHECKPOINT_EVERY == 0))
+                take_checkpoint(system, &ckpt);
             // send sigusr1 to all miners except this one, means start of next round
             for(i = 0; i < system->num_miners; i++){
                 if(system->miners[i].pid != this_miner.pid)
                     kill(system->miners[i].pid, SIGUSR1);
             }
-            sem_post(&(system->mutex));
+            lockprof_post(&(system->mutex));
+            if(checkpoint_due) // written outside the lock from the copy
+                save_checkpoint(&ckpt, opts.checkpoint);
+            trace_end(trace, TRACE_ROLLOVER, 0, round_id);
+            hist_record(&(stats->phases[PHASE_COMMIT]), (now_ns() - t_phase) / 1000);
+            if(retune_due){ // the others already mine the next block, a miner that keeps winning still recalibrates
+                nthreads = retune(&tuning, max_threads, tune_file, stats);
+                retune_due = 0;
+            }
         } else { // loser pepeHands
             // vote for the solution that potential winner posted
-            sem_wait(&(system->mutex));
+            trace_begin(trace, TRACE_VOTE, 0, round_id);
+            lock_system(system, stats);
             /* ----------- Protected ----------- */
-            if(system->current_block.solution == _solution) // if solution is correct in this miner's opinion
-                system->current_block.favorable_votes++;
-            system->current_block.total_votes++;
-            sem_post(&(system->mutex));
+            round_vote(&(system->current_block), _solution);
+            lockprof_post(&(system->mutex));
             /* ------------- end prot --------------- */
+            trace_end(trace, TRACE_VOTE, 0, round_id);
+            hist_record(&(stats->phases[PHASE_VOTE]), (now_ns() - t_phase) / 1000);
+            t_phase = now_ns();
+            if(retune_due){ // while the winner closes the round, the next SIGUSR1 stays pending
+                sigprocmask(SIG_BLOCK, &usr1, NULL);
+                nthreads = retune(&tuning, max_threads, tune_file, stats);
+                retune_due = 0;
+            }
+            trace_begin(trace, TRACE_WAIT, 0, round_id);
             sigsuspend(&a); // wait for SIGUSR1, means start of next round
+            trace_end(trace, TRACE_WAIT, 0, round_id);
+            sigprocmask(SIG_UNBLOCK, &usr1, NULL);
+            hist_record(&(stats->phases[PHASE_WAIT]), (now_ns() - t_phase) / 1000);
             // sigprocmask(SIG_BLOCK, &a, &old_a); // block SIGUSR1
             // while(!sigusr1_received) // wait for SIGUSR1
             //     sigsuspend(&old_a);
             // sigprocmask(SIG_UNBLOCK, &a, NULL); // unblock SIGUSR1
             // sigusr1_received = 0; // reset flag
         }
+        hist_record(&(stats->phases[PHASE_ROUND]), (now_ns() - t_round) / 1000);
     }
     // SHUTDOWN
+    flush_queue(stats); // a last try for the blocks still waiting for room, the rest are lost
+    if(pending_count > 0)
+        metrics_add(&(stats->mq_dropped), pending_count);
+    pending_count = 0;
+    close_queue();
+    if(stats != &local_metrics){
+        metrics_release(stats);
+        munmap(metrics, sizeof(Metrics));
+    }
     close(miner2register[1]);
     free(threads);
     free(miner_data);
     // delete miner from shared memory
-    sem_wait(&(system->mutex));
+    lockprof_wait(&(system->mutex));
     /* ----------- Protected ----------- */
     if(system->num_miners == 1){ // last miner
         printf("\nlast miner finished, deleting shared memory\n");
+        if(system->head_valid){
+            take_checkpoint(system, &ckpt);
+            if(save_checkpoint(&ckpt, opts.checkpoint) == 0)
+                printf("chain head %04d saved in %s\n", ckpt.head.id, opts.checkpoint);
+        }
         sem_destroy(&(system->mutex));
         delete_miner(system->miners, &(system->num_miners), this_miner.pid);
         munmap(system, sizeof(System));
         shm_unlink(SYSTEM_SHM);
+        shm_unlink(METRICS_SHM);
         return 0;
     }
     delete_miner(system->miners, &(system->num_miners), this_miner.pid);
-    sem_post(&(system->mutex));
+    if(!opts.wallet) // nobody can claim the coins of a process once it is gone
+        ledger_remove(&(system->ledger), this_miner.wallet);
+    lockprof_post(&(system->mutex));
     munmap(system, sizeof(System));
     shm_unlink(SYSTEM_SHM);
     /* ------------- end prot --------------- */
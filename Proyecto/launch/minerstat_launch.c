@@ -0,0 +1,138 @@
+/**
+ * @file minerstat_launch.c
+ * @author Enmanuel, Jorge
+ * @brief prints live rates and round percentiles from the metrics segment
+ * @version 0.1
+ * @date 2023-05-08
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The segment is mapped read only and never locked, every value is read
+ * with a relaxed atomic load while the miners keep writing.
+ */
+
+#include "../includes/miner.h"
+
+static const char *phase_names[NUM_PHASES] = {"round", "mine", "vote", "commit", "wait"};
+
+volatile sig_atomic_t shutdown = 0;
+
+void signal_handler(int sig) {
+    shutdown = 1;
+}
+
+/**
+ * @brief private function that adds the counters of the threads of a miner
+ */
+static void sum_threads(const MinerMetrics *slot, uint64_t *hashes, uint64_t *chunks, uint64_t *cancels) {
+    int j;
+    *hashes = *chunks = *cancels = 0;
+    for (j = 0; j < METRICS_MAX_THREADS; j++) {
+        *hashes += __atomic_load_n(&slot->threads[j].hashes, __ATOMIC_RELAXED);
+        *chunks += __atomic_load_n(&slot->threads[j].chunks, __ATOMIC_RELAXED);
+        *cancels += __atomic_load_n(&slot->threads[j].cancels, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Main function for minerstat
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    int fd, i, p;
+    long interval_ms = 1000, count = -1;
+    Metrics *metrics;
+    static Histogram merged[NUM_PHASES];
+    uint64_t prev_hashes[METRICS_MAX_MINERS] = {0}, prev_start[METRICS_MAX_MINERS] = {0};
+    uint64_t hashes, chunks, cancels, start, prev_ns, now, total_rate;
+    uint64_t mq[4]; // sent, dropped, coalesced, spilled
+    pid_t pid;
+    struct timespec sleep_time;
+    struct sigaction act;
+
+    if (argc > 3) {
+        fprintf(stdout, "Usage: %s [INTERVAL_MS] [COUNT]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 1 && (interval_ms = atol(argv[1])) <= 0) {
+        fprintf(stdout, "INTERVAL_MS must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2)
+        count = atol(argv[2]);
+
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGINT, &act, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if ((fd = shm_open(METRICS_SHM, O_RDONLY, 0)) == -1) {
+        fprintf(stdout, "no metrics segment, are the miners running?\n");
+        exit(EXIT_FAILURE);
+    }
+    metrics = mmap(NULL, sizeof(Metrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    sleep_time.tv_sec = interval_ms / 1000;
+    sleep_time.tv_nsec = (interval_ms % 1000) * 1000000;
+    prev_ns = now_ns();
+    while (!shutdown && count != 0) {
+        nanosleep(&sleep_time, NULL);
+        now = now_ns();
+        total_rate = 0;
+        memset(merged, 0, sizeof(merged));
+        memset(mq, 0, sizeof(mq));
+        fprintf(stdout, "%-8s %7s %8s %6s %12s %10s %8s\n",
+                    "pid", "threads", "rounds", "wins", "hashes/s", "chunks", "cancels");
+        for (i = 0; i < METRICS_MAX_MINERS; i++) {
+            const MinerMetrics *slot = &metrics->miners[i];
+            start = __atomic_load_n(&slot->start_ns, __ATOMIC_ACQUIRE);
+            pid = __atomic_load_n(&slot->pid, __ATOMIC_RELAXED);
+            if (pid == 0 || start == 0)
+                continue;
+            sum_threads(slot, &hashes, &chunks, &cancels);
+            if (start != prev_start[i]) { // new owner of the slot
+                prev_start[i] = start;
+                prev_hashes[i] = 0;
+            }
+            uint64_t rate = (hashes - prev_hashes[i]) * 1000000000ull / (now - prev_ns);
+            prev_hashes[i] = hashes;
+            total_rate += rate;
+            fprintf(stdout, "%-8d %7d %8lu %6lu %12lu %10lu %8lu\n", pid, slot->nthreads,
+                        (unsigned long)__atomic_load_n(&slot->rounds, __ATOMIC_RELAXED),
+                        (unsigned long)__atomic_load_n(&slot->wins, __ATOMIC_RELAXED),
+                        (unsigned long)rate, (unsigned long)chunks, (unsigned long)cancels);
+            for (p = 0; p < NUM_PHASES; p++)
+                hist_merge(&merged[p], &slot->phases[p]);
+            mq[0] += __atomic_load_n(&slot->mq_sent, __ATOMIC_RELAXED);
+            mq[1] += __atomic_load_n(&slot->mq_dropped, __ATOMIC_RELAXED);
+            mq[2] += __atomic_load_n(&slot->mq_coalesced, __ATOMIC_RELAXED);
+            mq[3] += __atomic_load_n(&slot->mq_spilled, __ATOMIC_RELAXED);
+        }
+        fprintf(stdout, "%-8s %7s %8s %6s %12lu\n", "total", "", "", "", (unsigned long)total_rate);
+        fprintf(stdout, "mq: %lu sent, %lu dropped, %lu coalesced, %lu spilled\n", (unsigned long)mq[0],
+                    (unsigned long)mq[1], (unsigned long)mq[2], (unsigned long)mq[3]);
+        fprintf(stdout, "%-8s %8s %10s %10s %10s %10s %10s  (us)\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+        for (p = 0; p < NUM_PHASES; p++)
+            fprintf(stdout, "%-8s %8lu %10lu %10lu %10lu %10lu %10lu\n", phase_names[p],
+                        (unsigned long)merged[p].count,
+                        (unsigned long)(merged[p].count ? merged[p].sum / merged[p].count : 0),
+                        (unsigned long)hist_percentile(&merged[p], 50),
+                        (unsigned long)hist_percentile(&merged[p], 90),
+                        (unsigned long)hist_percentile(&merged[p], 99),
+                        (unsigned long)merged[p].max);
+        fprintf(stdout, "-----------------------\n");
+        fflush(stdout);
+        prev_ns = now;
+        if (count > 0)
+            count--;
+    }
+    munmap(metrics, sizeof(Metrics));
+    return 0;
+}
@@ -10,45 +10,104 @@
 #include <string.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <semaphore.h>
 #include <signal.h>
 #include "../includes/miner.h"
-
-#define BUFFER_LENGTH 10
-#define SHM_NAME "/facepulls_shm"
+#include "../includes/ring.h"
+#include "../includes/verify.h"
+#include "../includes/format.h"
+#include "../includes/stats.h"
+#include "../includes/history.h"
+#include "../includes/trace.h"
 
 /* ----------------------------------------- GLOBALS ---------------------------------------- */
 
 struct timespec delay;
 volatile sig_atomic_t shutdown = 0;
+volatile sig_atomic_t frame_due = 0; // the summary has to be redrawn
+TraceRing *trace = NULL; // ring of the comprobador, NULL if tracing is off
 
 void signal_handler(int signum){
     fprintf(stdout, "\nfinishing by interrupt...\n");
     shutdown = 1;
 }
 
-typedef struct _sharedMemory{
-    Block blocks[BUFFER_LENGTH];
-    sem_t gym_mutex;
-    sem_t gym_empty;
-    sem_t gym_fill;
-    uint8_t using;
-    uint8_t reading;
-    uint8_t writing;
-} SharedMemory;
+void frame_handler(int signum){
+    frame_due = 1;
+}
+
+/**
+ * @brief where the comprobador publishes the verified blocks
+ */
+typedef struct _publisher{
+    SharedMemory *shmem; // ring read by the monitors
+    History history; // persisted copy for late monitors, file NULL if unavailable
+} Publisher;
 
 /* ----------------------------------------- FUNCTIONS ---------------------------------------*/
 
+/**
+ * @brief sink of the verification stage, publishes the blocks in arrival order
+ * @param block verified block
+ * @param info result of the verification
+ * @param arg (Publisher*) ring and history
+ */
+void publish_block(const Block *block, const BlockInfo *info, void *arg){
+    Publisher *publisher = (Publisher*) arg;
+    trace_begin(trace, TRACE_PUBLISH, 1, block->id);
+    // history first: a monitor replays it up to where its subscription starts
+    if(publisher->history.file)
+        history_append(&(publisher->history), block, info);
+    // blocks only while the ring is full
+    ring_push(publisher->shmem, block, info, &shutdown);
+    trace_end(trace, TRACE_PUBLISH, 1, block->id);
+}
+
+/**
+ * @brief next block of a monitor: first the backlog from the history, then the ring
+ * @param shmem ring
+ * @param sub subscriber id
+ * @param history backlog still to replay, NULL if none
+ * @param block where the block is copied
+ * @param info where the information about the block is copied
+ * @param stop the wait gives up when this becomes set
+ * @return int blocks lost before this one, -1 if stopped
+ */
+int next_block(SharedMemory *shmem, int sub, History *history, Block *block, BlockInfo *info, volatile sig_atomic_t *stop){
+    const RingFilter *filter = &(shmem->readers[sub].filter);
+    uint64_t lost = 0;
+    int ret;
+    while(history && history->file){
+        if(history_read(history, block, info, &lost) == -1){
+            history_close(history); // caught up, live from now on
+            break;
+        }
+        // the backlog goes through the same filter as the ring
+        if(ring_filter_match(filter, block, history->next - 1)){
+            info->header_only = (filter->flags & RING_HEADER_ONLY) != 0;
+            return lost;
+        }
+    }
+    if((ret = ring_pop(shmem, sub, block, info, stop)) == -1)
+        return -1;
+    return ret + lost;
+}
+
 /**
  * @brief Comprobador is called when the shared memory does not exist, it creates it and
  *        starts listening to the MQ for messages from the miners and updates the shared memory
- * @param lag (int) time to wait between each message
+ * @param lossy (uint8_t) 1 if the comprobador must never wait for slow monitors
+ * @param nverifiers (int) threads verifying the blocks
  * @return void
 */
-void comprobador(){
-    int fd_shm, index, fd_sys;
+void comprobador(uint8_t lossy, int nverifiers){
+    int fd_shm, fd_sys, n, i;
+    static Publisher publisher;
     SharedMemory *shmem = NULL;
-    Block msg;
+    Block msgs[VERIFY_BATCH];
+    struct timespec now;
+    Verifier *verifier;
     mqd_t mq;
     struct mq_attr attr;
     System *_system;
@@ -76,35 +135,12 @@ void comprobador(){
         exit(EXIT_FAILURE);
     }
 
+    // the history survives restarts, the ring numbers its blocks after it
+    publisher.shmem = shmem;
+    if(history_open(&(publisher.history), HISTORY_FILE, 1) == -1)
+        perror("history_open"); // monitors can still attach live
     // Initialize the shared memory
-    SharedMemory initialize = {
-        .using = 0,
-        .reading = 0,
-        .writing = 0
-    };
-    memcpy(shmem, &initialize, sizeof(SharedMemory));
-
-    // Initialize the semaphores
-    if (sem_init(&(shmem->gym_mutex), 1, 1) == -1){
-        perror("sem_init");
-        shm_unlink(SHM_NAME);
-        exit(EXIT_FAILURE);
-    }
-
-    if(sem_init(&(shmem->gym_empty), 1, BUFFER_LENGTH) == -1){
-        perror("sem_init");
-        sem_destroy(&(shmem->gym_mutex));
-        shm_unlink(SHM_NAME);
-        exit(EXIT_FAILURE);
-    }
-
-    if(sem_init(&shmem->gym_fill, 1, 0) == -1){
-        perror("sem_init");
-        sem_destroy(&(shmem->gym_mutex));
-        sem_destroy(&(shmem->gym_empty));
-        shm_unlink(SHM_NAME);
-        exit(EXIT_FAILURE);
-    }
+    ring_init(shmem, lossy, publisher.history.file ? publisher.history.file->head : 0);
 
     //set message queue attributes
     attr = (struct mq_attr){
@@ -116,32 +152,18 @@ void comprobador(){
 
     if((mq = mq_open(MQ_NAME, O_CREAT | O_RDONLY, S_IRUSR | S_IWUSR, &attr)) == (mqd_t)-1){
         perror("mq_open");
-        if(shmem->using == 1){
-            sem_destroy(&(shmem->gym_mutex));
-            sem_destroy(&(shmem->gym_empty));
-            sem_destroy(&(shmem->gym_fill));
+        if(__atomic_sub_fetch(&(shmem->using), 1, __ATOMIC_ACQ_REL) == 0)
             shm_unlink(SHM_NAME);
-        }
-        shmem->using--;
         munmap(shmem, sizeof(SharedMemory));
         exit(EXIT_FAILURE);
     }
 
     //NOTIFY MINERS THAT MONITOR IS UP
-    fd_sys = shm_open(SYSTEM_SHM, O_RDWR, 0666);
-    if(fd_sys == -1){
-        do {
-            sleep(1);
-            if(errno == EINTR){ // if sleep was interrupted, shutdown was forced
-                sem_destroy(&(shmem->gym_mutex));
-                sem_destroy(&(shmem->gym_empty));
-                sem_destroy(&(shmem->gym_fill));
-                shm_unlink(SHM_NAME);
-                mq_unlink(MQ_NAME);
-                return;
-            }
-            fd_sys = shm_open(SYSTEM_SHM, O_RDWR, 0666);
-        } while (fd_sys == -1);
+    // sleeps until the first miner creates the system, no polling
+    if((fd_sys = wait_for_shm(SYSTEM_SHM, O_RDWR, sizeof(System), &shutdown)) == -1){
+        shm_unlink(SHM_NAME); // interrupted, shutdown was forced
+        mq_unlink(MQ_NAME);
+        return;
     }
     _system = mmap(NULL, sizeof(System), PROT_READ | PROT_WRITE, MAP_SHARED, fd_sys, 0);
     close(fd_sys);
@@ -150,21 +172,32 @@ void comprobador(){
         shm_unlink("/deadlift_shm");
         exit(EXIT_FAILURE);
     }
-    sem_wait(&(_system->mutex));
+    if(wait_ready(&(_system->ready), &shutdown) == -1){
+        shm_unlink(SHM_NAME);
+        mq_unlink(MQ_NAME);
+        munmap(_system, sizeof(System));
+        return;
+    }
+    // verification runs on its own threads, out of the receive loop
+    if((verifier = verifier_start(nverifiers, publish_block, &publisher)) == NULL){
+        mq_close(mq);
+        munmap(shmem, sizeof(SharedMemory));
+        shm_unlink(SHM_NAME);
+        exit(EXIT_FAILURE);
+    }
+    trace = trace_open("comprobador");
+    lockprof_wait(&(_system->mutex));
     _system->monitor_up = 1;
-    sem_post(&(_system->mutex));
+    lockprof_post(&(_system->mutex));
 
     while(!shutdown){
         // receive message from MQ
-        if(mq_receive(mq, (char *)&msg, SIZE, NULL) == -1){
-            if(shmem->using == 1){
-                sem_destroy(&(shmem->gym_mutex));
-                sem_destroy(&(shmem->gym_empty));
-                sem_destroy(&(shmem->gym_fill));
+        if(mq_receive(mq, (char *)&msgs[0], SIZE, NULL) == -1){
+            verifier_stop(verifier);
+            if(__atomic_sub_fetch(&(shmem->using), 1, __ATOMIC_ACQ_REL) == 0){
                 shm_unlink(SHM_NAME);
                 shm_unlink("/deadlift_shm");
             }
-            shmem->using--;
             mq_close(mq);
             munmap(shmem, sizeof(SharedMemory));
             if(errno = EINTR){
@@ -175,40 +208,109 @@ void comprobador(){
                 exit(EXIT_FAILURE);
             }
         }
-        sem_wait(&(shmem->gym_empty));
-        sem_wait(&(shmem->gym_mutex));
-
-        /* ----------- Protected ----------- */
-        index = shmem->writing % BUFFER_LENGTH;
-        shmem->writing++;
-        shmem->blocks[index] = msg;
-        /* ------------- end prot --------------- */
-        
-        sem_post(&(shmem->gym_mutex));
-        sem_post(&(shmem->gym_fill));
+        // take whatever else is already queued, without waiting
+        clock_gettime(CLOCK_REALTIME, &now);
+        for(n = 1; n < VERIFY_BATCH; n++)
+            if(mq_timedreceive(mq, (char *)&msgs[n], SIZE, NULL, &now) == -1)
+                break;
+        for(i = 0; trace && i < n; i++)
+            trace_instant(trace, TRACE_RECEIVE, 0, msgs[i].id);
+        verifier_submit(verifier, msgs, n);
     }
-    sem_wait(&(_system->mutex));
+    verifier_stop(verifier);
+    history_close(&(publisher.history));
+    lockprof_wait(&(_system->mutex));
     _system->monitor_up = 0;
-    sem_post(&(_system->mutex));
+    lockprof_post(&(_system->mutex));
     mq_close(mq);
     shm_unlink("/deadlift_shm");
 }
 
+/**
+ * @brief Summary mode of the monitor, rolling statistics redrawn at a fixed frame rate
+ * @param shmem ring
+ * @param sub subscriber id of this monitor
+ * @param fps frames per second
+ * @param window blocks kept in the statistics
+ * @param history backlog to replay first, NULL if none
+ * @return void
+*/
+void summarize(SharedMemory *shmem, int sub, int fps, uint32_t window, History *history){
+    static Stats stats;
+    static char frame[STATS_SUMMARY_SIZE];
+    static LedgerEntry wallets[LEDGER_SIZE];
+    int num_wallets = 0, n;
+    struct sigaction act;
+    struct itimerval timer;
+    Block read_block;
+    BlockInfo info;
+    size_t len;
+    int lost, tty = isatty(STDOUT_FILENO);
+
+    if(stats_init(&stats, window) == -1){
+        perror("stats_init");
+        return;
+    }
+    // no SA_RESTART, the alarm has to interrupt the wait for the next block
+    act.sa_handler = frame_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if(sigaction(SIGALRM, &act, NULL) < 0){
+        perror("sigaction");
+        stats_free(&stats);
+        return;
+    }
+    timer.it_interval.tv_sec = 1 / fps;
+    timer.it_interval.tv_usec = 1000000 / fps % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    while(!shutdown){
+        // ring_pop gives up when the frame is due, even if there are no blocks
+        if((lost = next_block(shmem, sub, history, &read_block, &info, &frame_due)) != -1){
+            if(lost > 0)
+                stats_lost(&stats, lost);
+            stats_add(&stats, &read_block, &info, now_ns());
+        }
+        if(!frame_due)
+            continue;
+        frame_due = 0;
+        len = 0;
+        if(tty) // redraw in place
+            len = strlen(strcpy(frame, "\033[H\033[J"));
+        // balances from the ledger of the miners, the last ones stay once they are gone
+        if((n = ledger_read(SYSTEM_SHM, offsetof(System, ledger), wallets, LEDGER_SIZE)) != -1)
+            num_wallets = n;
+        len += stats_render(&stats, now_ns(), wallets, num_wallets, frame + len, sizeof(frame) - len);
+        if(write(STDOUT_FILENO, frame, len) == -1 && errno != EINTR)
+            break;
+    }
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+    stats_free(&stats);
+}
+
 /**
  * @brief Monitor is called when the shared memory exists, it reads it and prints the info
- * @param fd_shm (int) file descriptor of the shared memory
- * @param lag (int) time to wait between each message
+ * @param format (OutputFormat) text, JSON Lines or CSV
+ * @param fps frames per second of the summary, 0 to print every block
+ * @param window blocks kept in the statistics of the summary
+ * @param replay 1 to replay the history from the sequence number from before going live
+ * @param from first block to replay, negative to count back from the live blocks
+ * @param filter blocks this monitor wants
  * @return void
 */
-void monitor(){
+void monitor(OutputFormat format, int fps, uint32_t window, uint8_t replay, int64_t from, const RingFilter *filter){
     SharedMemory *shmem = NULL;
-    int aux_reading = 0, fd_shm = -1;
-    uint8_t num_miners = 0, i;
+    int fd_shm = -1, sub, lost;
+    static Output out; // reused for every block
+    static History history;
     Block read_block;
+    BlockInfo info;
 
-    do {
-        fd_shm = shm_open(SHM_NAME, O_RDWR, 0);
-    } while(fd_shm == -1 && errno == ENOENT);
+    // sleeps until the comprobador creates the segment
+    if((fd_shm = wait_for_shm(SHM_NAME, O_RDWR, sizeof(SharedMemory), &shutdown)) == -1)
+        return;
 
     // Mapping of the memory segment
     shmem = mmap(NULL, sizeof(SharedMemory), PROT_READ | PROT_WRITE, MAP_SHARED, fd_shm, 0);
@@ -219,43 +321,100 @@ void monitor(){
         exit(EXIT_FAILURE);
     }
 
-    sem_wait(&(shmem->gym_mutex));
-    /* ----------- Protected ----------- */
-    shmem->using++;
-    /* ------------- end prot --------------- */
-    sem_post(&(shmem->gym_mutex));
+    // the comprobador may still be initializing the ring
+    if(wait_ready(&(shmem->ready), &shutdown) == -1){
+        munmap(shmem, sizeof(SharedMemory));
+        return;
+    }
+    if((sub = ring_subscribe(shmem, filter)) == -1){
+        fprintf(stdout, "too many monitors attached\n");
+        munmap(shmem, sizeof(SharedMemory));
+        exit(EXIT_FAILURE);
+    }
+    // the blocks before the subscription come from the history, no gap in between
+    if(replay){
+        if(history_open(&history, HISTORY_FILE, 0) == -1)
+            fprintf(stderr, "no history in %s, starting live\n", HISTORY_FILE);
+        else
+            history_seek(&history, from, ring_sequence(shmem, sub));
+    }
 
-    fprintf(stdout,"[%08d] Printing blocks...\n", getpid ());
+    if(fps > 0){
+        summarize(shmem, sub, fps, window, &history);
+        history_close(&history);
+        ring_unsubscribe(shmem, sub);
+        munmap(shmem, sizeof(SharedMemory));
+        return;
+    }
+    if(format == FORMAT_TEXT){
+        fprintf(stdout,"[%08d] Printing blocks...\n", getpid ());
+        fflush(stdout);
+    }
+    output_init(&out, STDOUT_FILENO, format);
     while(!shutdown){
-        sem_wait(&(shmem->gym_fill));
-        sem_wait(&(shmem->gym_mutex));
-        /* ----------- Protected ----------- */
-
-        aux_reading = shmem->reading % BUFFER_LENGTH;
-        shmem->reading++;
-        read_block = shmem->blocks[aux_reading];
-        sem_post(&(shmem->gym_mutex));
-        sem_post(&(shmem->gym_empty));
-        
-        /* ------------- end prot --------------- */
-        if(shutdown) break;
-        if(read_block.favorable_votes == read_block.total_votes)
-            num_miners = read_block.total_votes;
-        fprintf(stdout, "Id:\t\t%04d\nWinner:\t\t%d\nTarget:\t\t%ld\nSolution:\t%08ld\nVotes:\t\t%d/%d",
-                    read_block.id, read_block.winner, read_block.target, read_block.solution, read_block.favorable_votes, num_miners);
-        read_block.favorable_votes == num_miners ? fprintf(stdout, "\t(validated) WidePeepoHappy") : fprintf(stdout, "\t(rejected) pepeHands");
-        fprintf(stdout, "\nWallets:");
-        for(i = 0; i < num_miners; i++)
-            fprintf(stdout, "\t%d:%02d", read_block.miners[i].pid, read_block.miners[i].coins);
-        fprintf(stdout, "\n-----------------------\n");
+        // write what is pending before waiting for the next block
+        if(out.len > 0 && ring_available(shmem, sub) == 0)
+            output_flush(&out);
+        // blocks only while there is no new block for this monitor
+        if((lost = next_block(shmem, sub, &history, &read_block, &info, &shutdown)) == -1)
+            break;
+        if(lost > 0)
+            output_lost(&out, lost);
+        output_block(&out, &read_block, &info);
     }
+    output_flush(&out);
+    history_close(&history);
+    ring_unsubscribe(shmem, sub);
+    munmap(shmem, sizeof(SharedMemory));
 }
 
 
 /* -----------------------------------------   MAIN   --------------------------------------- */
 
-int main(){
+int main(int argc, char *argv[]){
     struct sigaction act;
+    uint8_t lossy = 0;
+    int fd_shm, i, fps = 0, nverifiers = sysconf(_SC_NPROCESSORS_ONLN);
+    long window = STATS_WINDOW;
+    uint8_t replay = 0;
+    int64_t from = 0;
+    RingFilter filter;
+    char *token;
+    OutputFormat format = FORMAT_TEXT;
+    memset(&filter, 0, sizeof(RingFilter));
+    for(i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "--lossy"))
+            lossy = 1;
+        else if(!strncmp(argv[i], "--verifiers=", 12) && atoi(argv[i] + 12) > 0)
+            nverifiers = atoi(argv[i] + 12);
+        else if(!strncmp(argv[i], "--format=", 9) && output_parse_format(argv[i] + 9, &format) == 0)
+            continue;
+        else if(!strcmp(argv[i], "--summary"))
+            fps = STATS_FPS;
+        else if(!strncmp(argv[i], "--summary=", 10) && (fps = atoi(argv[i] + 10)) > 0 && fps <= 1000)
+            continue;
+        else if(!strncmp(argv[i], "--from=", 7)){
+            from = atoll(argv[i] + 7);
+            replay = 1;
+        }
+        else if(!strcmp(argv[i], "--only-rejected"))
+            filter.flags |= RING_REJECTED_ONLY;
+        else if(!strcmp(argv[i], "--header-only"))
+            filter.flags |= RING_HEADER_ONLY;
+        else if(!strncmp(argv[i], "--every=", 8) && atoi(argv[i] + 8) > 0)
+            filter.every = atoi(argv[i] + 8);
+        else if(!strncmp(argv[i], "--winner=", 9)){
+            for(token = strtok(argv[i] + 9, ","); token && filter.num_pids < RING_FILTER_PIDS; token = strtok(NULL, ","))
+                filter.pids[filter.num_pids++] = atoi(token);
+        }
+        else if(!strncmp(argv[i], "--window=", 9) && (window = atol(argv[i] + 9)) > 0 && window <= STATS_MAX_WINDOW)
+            continue;
+        else {
+            fprintf(stdout, "Usage: %s [--lossy] [--verifiers=N] [--format=text|json|csv] [--summary[=FPS]] [--window=BLOCKS] [--from=SEQ]\n"
+                            "       [--only-rejected] [--winner=PID[,PID...]] [--every=N] [--header-only]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
     act.sa_handler = signal_handler; // assign signal handler
     act.sa_flags = 0;
     sigfillset(&(act.sa_mask)); // start with a full mask
@@ -265,17 +424,23 @@ int main(){
         return 1;
     }
     sigdelset(&(act.sa_mask), SIGINT); // unblock SIGINT
+    // if the comprobador is already running, this is just one more monitor
+    if((fd_shm = shm_open(SHM_NAME, O_RDWR, 0)) != -1){
+        close(fd_shm);
+        monitor(format, fps, window, replay, from, &filter);
+        return 0;
+    }
     pid_t pid = fork();
     if(pid == -1){
         perror("fork");
         exit(EXIT_FAILURE);
     }
     if(pid != 0){ // parent
-        comprobador();
+        comprobador(lossy, nverifiers);
         wait(NULL);
     }
     else
-        monitor();
+        monitor(format, fps, window, replay, from, &filter);
 
     shm_unlink(SHM_NAME);
     mq_unlink(MQ_NAME); 
@@ -0,0 +1,149 @@
+/**
+ * @file replay_launch.c
+ * @author Enmanuel, Jorge
+ * @brief feeds a recorded chain log into the comprobador, in place of the miners
+ * @version 0.1
+ * @date 2023-05-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The log is mapped and decoded record by record, and every block is sent
+ * to the MQ of the comprobador exactly like a miner would, stamped with
+ * the time it was queued, so a monitor in summary mode shows the end to
+ * end latency. Blocks are paced at a fixed rate against an absolute
+ * schedule, or sent as fast as the queue takes them. Sends block while
+ * the queue is full, the time spent there is the backpressure of the
+ * comprobador and the monitors.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/chain.h"
+
+volatile sig_atomic_t shutdown = 0;
+
+void signal_handler(int sig) {
+    shutdown = 1;
+}
+
+/**
+ * @brief Main function for the replay
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    int fd, i;
+    long n, rate = 0, repeat = 1, round;
+    size_t offset;
+    uint64_t sent = 0, start, stalled = 0, t;
+    struct stat st;
+    struct mq_attr attr;
+    struct sigaction act;
+    struct timespec due;
+    uint8_t *map;
+    ChainCodec codec;
+    System *system;
+    Block block;
+    mqd_t mq;
+
+    if (argc < 2) {
+        fprintf(stdout, "Usage: %s <CHAIN_LOG> [--rate=BLOCKS_PER_SEC] [--repeat=N]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 2; i < argc; i++) {
+        if (!strncmp(argv[i], "--rate=", 7) && (rate = atol(argv[i] + 7)) >= 0)
+            continue;
+        else if (!strncmp(argv[i], "--repeat=", 9) && (repeat = atol(argv[i] + 9)) > 0)
+            continue;
+        fprintf(stdout, "Usage: %s <CHAIN_LOG> [--rate=BLOCKS_PER_SEC] [--repeat=N]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((fd = open(argv[1], O_RDONLY)) == -1) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < CHAIN_HEADER_SIZE) {
+        fprintf(stdout, "%s is not a chain log\n", argv[1]);
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    if (chain_read_header(map, st.st_size, NULL) == -1) {
+        fprintf(stdout, "%s is not a chain log\n", argv[1]);
+        munmap(map, st.st_size);
+        exit(EXIT_FAILURE);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // the comprobador waits for the system before receiving, the replay stands in for the miners
+    if ((fd = shm_open(SYSTEM_SHM, O_RDONLY, 0)) != -1) {
+        close(fd);
+        fprintf(stdout, "the miners are running, stop them before replaying\n");
+        munmap(map, st.st_size);
+        exit(EXIT_FAILURE);
+    }
+    system = create_system();
+
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGINT, &act, NULL) < 0) {
+        perror("sigaction");
+        shm_unlink(SYSTEM_SHM);
+        exit(EXIT_FAILURE);
+    }
+    attr = (struct mq_attr){
+        .mq_flags = 0,
+        .mq_maxmsg = MAX_MSG,
+        .mq_msgsize = SIZE,
+        .mq_curmsgs = 0
+    };
+    if ((mq = mq_open(MQ_NAME, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR, &attr)) == (mqd_t) -1) {
+        perror("mq_open");
+        shm_unlink(SYSTEM_SHM);
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_ns();
+    for (round = 0; round < repeat && !shutdown; round++) {
+        chain_codec_init(&codec, 0);
+        offset = CHAIN_HEADER_SIZE;
+        while (offset < st.st_size && !shutdown) {
+            if ((n = chain_decode(&codec, map + offset, st.st_size - offset, &block)) < 0) {
+                fprintf(stdout, "corrupt record at offset %zu\n", offset);
+                break;
+            }
+            offset += n;
+            if (rate > 0) { // absolute schedule, a late block does not delay the next ones
+                t = start + sent * 1000000000ull / rate;
+                due.tv_sec = t / 1000000000ull;
+                due.tv_nsec = t % 1000000000ull;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+            }
+            t = now_ns();
+            block.sent_ns = t;
+            if (mq_send(mq, (char*)&block, sizeof(Block), 2) == -1) {
+                if (errno != EINTR)
+                    perror("mq_send");
+                break;
+            }
+            stalled += now_ns() - t;
+            sent++;
+        }
+    }
+    t = now_ns() - start;
+
+    fprintf(stdout, "Blocks:\t\t%lu\n", (unsigned long)sent);
+    fprintf(stdout, "Time:\t\t%.3f s\t%.0f blocks/s\n", t / 1e9, t ? sent * 1e9 / t : 0);
+    fprintf(stdout, "Queue full:\t%.3f s (%.1f%%)\n", stalled / 1e9, t ? 100.0 * stalled / t : 0);
+
+    mq_close(mq);
+    munmap(system, sizeof(System));
+    shm_unlink(SYSTEM_SHM);
+    munmap(map, st.st_size);
+    return 0;
+}
@@ -0,0 +1,509 @@
+/**
+ * @file sim_launch.c
+ * @author Enmanuel, Jorge
+ * @brief deterministic simulation of the miners, register and monitor in one process
+ * @version 0.1
+ * @date 2023-05-27
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * N virtual miners run the round protocol of the real miner (round_join,
+ * round_publish, round_vote, round_close and round_next on a private
+ * System) under a discrete event scheduler with virtual time. Signals, the
+ * mutex of the system, the vote polling of the winner and the MQ of the
+ * comprobador are events with a configurable cost, so the protocol is
+ * measured on its own. The proof of work is solved for real, once per
+ * round, so the chain is valid, but the hashing time of each miner is
+ * virtual: the hashes its threads need times a hash cost, with a seeded
+ * jitter that decides who wins.
+ *
+ * Events are ordered by time and then by creation, and all the randomness
+ * comes from the seed, so a seed always produces the same interleaving.
+ * The digest at the end fingerprints the sequence of events, --trace
+ * prints it.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/pow.h"
+#include "../includes/chain.h"
+#include "../includes/format.h"
+
+#define SIM_PID_BASE 1000 // virtual pids, the ledger needs them non zero
+#define SIM_HEAP 1024 // initial size of the event queue
+#define SIM_FNV_OFFSET 14695981039346656037ull
+#define SIM_FNV_PRIME 1099511628211ull
+
+/**
+ * @brief events of the simulation
+ */
+typedef enum _simEventType{
+    EV_START, // a miner starts a round
+    EV_FOUND, // its threads are done
+    EV_USR1, // start of the next round reaches a miner
+    EV_USR2, // start of the voting reaches a miner
+    EV_POLL, // the winner checks the votes
+    EV_MONITOR, // a block reaches the comprobador
+    NUM_EVENT_TYPES
+} SimEventType;
+
+static const char *event_names[NUM_EVENT_TYPES] = {"start", "found", "usr1", "usr2", "poll", "monitor"};
+
+typedef struct _simEvent{
+    uint64_t time; // virtual ns
+    uint64_t seq; // creation order, breaks ties
+    SimEventType type;
+    int miner;
+    int arg;
+} SimEvent;
+
+/**
+ * @brief where a virtual miner is in the protocol
+ */
+typedef enum _simState{
+    S_MINING,
+    S_VOTING, // winner, waiting for the votes
+    S_WAITING // in sigsuspend, waiting for SIGUSR1
+} SimState;
+
+typedef struct _simMiner{
+    Miner miner;
+    SimState state;
+    uint8_t sigusr2_received;
+    long solution; // last solution found, like _solution of the miner
+    long pending; // solution its threads will find this round, -1 if none
+    uint64_t round_start;
+    uint64_t hash_ns; // virtual hashing time of this round
+} SimMiner;
+
+/**
+ * @brief costs of the protocol, virtual ns
+ */
+typedef struct _simConfig{
+    int miners;
+    int threads;
+    long rounds; // blocks to commit, 0 to run for seconds
+    uint64_t end_ns; // virtual time to stop, 0 to run for rounds
+    uint64_t seed;
+    double hash_ns; // per hash and thread
+    double jitter; // fraction of the hashing time, uniform
+    uint64_t signal_ns; // kill to handler
+    uint64_t lock_ns; // one critical section
+    uint64_t thread_ns; // creating and joining the threads
+    uint64_t mq_ns; // MQ to the comprobador
+    uint8_t trace;
+} SimConfig;
+
+/**
+ * @brief the whole simulation
+ */
+typedef struct _sim{
+    SimConfig config;
+    System system;
+    SimMiner miners[MAX_MINERS];
+    SimEvent *heap;
+    int heap_len;
+    int heap_size;
+    uint64_t seq;
+    uint64_t now;
+    uint64_t rng;
+    uint64_t digest;
+    long solution; // solution of the current block, computed once per round
+    long hashes; // hashes the threads of a miner need to find it
+    uint64_t lock_free; // when the mutex is released
+    Block mq[MAX_MSG]; // blocks on their way to the comprobador
+    int mq_head, mq_count;
+    /* results */
+    uint64_t events[NUM_EVENT_TYPES];
+    uint64_t blocks, accepted, verified, monitored, lost_usr1, mq_dropped, pipe_writes;
+    uint64_t locks, lock_hold, lock_wait, lock_wait_max;
+    uint64_t hash_total;
+    Histogram round, hashing, protocol; // us
+    Histogram vote; // us, the winner waiting for the votes
+    Histogram ballot; // us, a loser waiting for the mutex and voting
+} Sim;
+
+/**
+ * @brief private function, xorshift64* generator
+ */
+static uint64_t sim_random(Sim *sim) {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng * 2685821657736338717ull;
+}
+
+/**
+ * @brief private function, uniform in [0, 1)
+ */
+static double sim_uniform(Sim *sim) {
+    return (sim_random(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int event_before(const SimEvent *a, const SimEvent *b) {
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+/**
+ * @brief private function that schedules an event
+ */
+static void schedule(Sim *sim, uint64_t time, SimEventType type, int miner, int arg) {
+    SimEvent ev = {time, sim->seq++, type, miner, arg}, tmp;
+    int i;
+    if (sim->heap_len == sim->heap_size) {
+        sim->heap_size *= 2;
+        if ((sim->heap = realloc(sim->heap, sim->heap_size * sizeof(SimEvent))) == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    i = sim->heap_len++;
+    sim->heap[i] = ev;
+    while (i > 0 && event_before(&sim->heap[i], &sim->heap[(i - 1) / 2])) {
+        tmp = sim->heap[i];
+        sim->heap[i] = sim->heap[(i - 1) / 2];
+        sim->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * @brief private function that takes the next event
+ * @return int 0, -1 if there are none
+ */
+static int next_event(Sim *sim, SimEvent *ev) {
+    SimEvent tmp;
+    int i = 0, child;
+    if (sim->heap_len == 0)
+        return -1;
+    *ev = sim->heap[0];
+    sim->heap[0] = sim->heap[--sim->heap_len];
+    while ((child = 2 * i + 1) < sim->heap_len) {
+        if (child + 1 < sim->heap_len && event_before(&sim->heap[child + 1], &sim->heap[child]))
+            child++;
+        if (!event_before(&sim->heap[child], &sim->heap[i]))
+            break;
+        tmp = sim->heap[i];
+        sim->heap[i] = sim->heap[child];
+        sim->heap[child] = tmp;
+        i = child;
+    }
+    return 0;
+}
+
+/**
+ * @brief private function, takes the mutex of the system at the current time
+ * @return uint64_t when the critical section ends
+ */
+static uint64_t sim_lock(Sim *sim) {
+    uint64_t acquire = sim->now > sim->lock_free ? sim->now : sim->lock_free;
+    uint64_t wait = acquire - sim->now;
+    sim->lock_free = acquire + sim->config.lock_ns;
+    sim->locks++;
+    sim->lock_hold += sim->config.lock_ns;
+    sim->lock_wait += wait;
+    if (wait > sim->lock_wait_max)
+        sim->lock_wait_max = wait;
+    return sim->lock_free;
+}
+
+/**
+ * @brief private function that solves the current block like the threads of
+ * a miner would: every thread searches its part of the range and the first
+ * one to get to a solution wins
+ */
+static void sim_solve(Sim *sim) {
+    long start, end, x, offset, best = -1;
+    long target = sim->system.current_block.target;
+    int j;
+    sim->solution = -1;
+    for (j = 0; j < sim->config.threads; j++) {
+        start = j * ((POW_LIMIT - 1) / sim->config.threads);
+        end = (j + 1) * ((POW_LIMIT - 1) / sim->config.threads);
+        if ((x = pow_search_simd(start, end, target)) == -1)
+            continue;
+        offset = x - start;
+        if (best == -1 || offset < best) {
+            best = offset;
+            sim->solution = x;
+        }
+    }
+    // hashes of the thread that finds it, or of the whole part if nobody does
+    sim->hashes = best == -1 ? (POW_LIMIT - 1) / sim->config.threads : best + 1;
+}
+
+/**
+ * @brief private function that sends a signal to every miner except one
+ */
+static void signal_all(Sim *sim, uint64_t time, SimEventType type, const Miner *miners, int n, pid_t except) {
+    int i;
+    for (i = 0; i < n; i++)
+        if (miners[i].pid != except)
+            schedule(sim, time + sim->config.signal_ns, type, miners[i].pid - SIM_PID_BASE, 0);
+}
+
+static void on_start(Sim *sim, SimMiner *m, int index) {
+    uint64_t t;
+    double jitter = 1 + sim->config.jitter * (2 * sim_uniform(sim) - 1);
+    m->state = S_MINING;
+    m->sigusr2_received = 0;
+    m->round_start = sim->now;
+    m->pending = sim->solution; // the target is read at the start of the round
+    t = sim_lock(sim);
+    round_join(&(sim->system.current_block), &(m->miner));
+    m->hash_ns = sim->hashes * sim->config.hash_ns * jitter;
+    sim->hash_total += sim->hashes * sim->config.threads;
+    schedule(sim, t + sim->config.thread_ns + m->hash_ns, EV_FOUND, index, 0);
+}
+
+static void on_found(Sim *sim, SimMiner *m, int index) {
+    Block *block = &(sim->system.current_block);
+    uint64_t t;
+    if (m->state != S_MINING)
+        return;
+    if (m->pending != -1)
+        m->solution = m->pending;
+    t = sim_lock(sim);
+    if (m->sigusr2_received == 0) { // winner
+        round_publish(block, m->solution);
+        signal_all(sim, t, EV_USR2, block->miners, block->num_voters, m->miner.pid);
+        m->state = S_VOTING;
+        schedule(sim, t, EV_POLL, index, 0);
+    } else { // loser
+        round_vote(block, m->solution);
+        m->state = S_WAITING;
+        hist_record(&sim->ballot, (t - sim->now) / 1000);
+    }
+}
+
+static void on_poll(Sim *sim, SimMiner *m, int index, int polls, FILE *chain, ChainCodec *codec) {
+    Block *block = &(sim->system.current_block);
+    uint8_t record[CHAIN_MAX_RECORD];
+    size_t len;
+    uint64_t t, round_ns;
+    if (block->total_votes != block->num_voters && polls != VOTE_POLLS) {
+        schedule(sim, sim->now + VOTE_POLL_NS, EV_POLL, index, polls + 1);
+        return;
+    }
+    hist_record(&sim->vote, (sim->now - m->round_start - sim->config.thread_ns - m->hash_ns) / 1000);
+    t = sim_lock(sim); // the close is a critical section, like in the miner
+    sim->accepted += round_close(&(sim->system), &(m->miner));
+    sim->blocks++;
+    sim->pipe_writes++; // to the register
+    if (chain) {
+        len = chain_encode(codec, block, record);
+        fwrite(record, 1, len, chain);
+    }
+    if (sim->mq_count == MAX_MSG) { // drop the oldest, like MQ_DROP_OLDEST
+        sim->mq_head = (sim->mq_head + 1) % MAX_MSG;
+        sim->mq_count--;
+        sim->mq_dropped++;
+    }
+    block->sent_ns = t;
+    sim->mq[(sim->mq_head + sim->mq_count++) % MAX_MSG] = *block;
+    schedule(sim, t + sim->config.mq_ns, EV_MONITOR, index, 0);
+
+    t = sim_lock(sim);
+    round_next(&(sim->system));
+    sim_solve(sim);
+    signal_all(sim, t, EV_USR1, sim->system.miners, sim->system.num_miners, m->miner.pid);
+    round_ns = t - m->round_start;
+    hist_record(&sim->round, round_ns / 1000);
+    hist_record(&sim->hashing, m->hash_ns / 1000);
+    hist_record(&sim->protocol, (round_ns - m->hash_ns) / 1000);
+    schedule(sim, t, EV_START, index, 0);
+}
+
+static void on_monitor(Sim *sim, Output *out) {
+    Block *block = &(sim->mq[sim->mq_head]);
+    BlockInfo info = {0};
+    if (sim->mq_count == 0) // dropped on the way
+        return;
+    info.verified = pow_hash(block->solution) == block->target;
+    sim->verified += info.verified;
+    sim->monitored++; // also the blocks drained at the end, not only the EV_MONITOR events
+    if (out)
+        output_block(out, block, &info);
+    sim->mq_head = (sim->mq_head + 1) % MAX_MSG;
+    sim->mq_count--;
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--miners=N] [--threads=T] [--rounds=N | --seconds=S] [--seed=N]\n"
+                    "       [--hash-ns=NS] [--jitter=PCT] [--signal-ns=NS] [--lock-ns=NS] [--thread-ns=NS]\n"
+                    "       [--mq-ns=NS] [--chain=FILE] [--print[=text|json|csv]] [--trace]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void print_hist(const char *name, const Histogram *hist) {
+    fprintf(stdout, "%-9s %8lu %10lu %10lu %10lu %10lu %10lu\n", name, (unsigned long)hist->count,
+                (unsigned long)(hist->count ? hist->sum / hist->count : 0),
+                (unsigned long)hist_percentile(hist, 50), (unsigned long)hist_percentile(hist, 90),
+                (unsigned long)hist_percentile(hist, 99), (unsigned long)hist->max);
+}
+
+/**
+ * @brief Main function for the simulator
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    static Sim sim;
+    static Output output;
+    SimConfig *cfg = &sim.config;
+    OutputFormat format = FORMAT_TEXT;
+    Output *out = NULL;
+    ChainCodec codec;
+    FILE *chain = NULL;
+    SimEvent ev;
+    SimMiner *m;
+    uint64_t fields[4];
+    int i, k;
+
+    *cfg = (SimConfig){
+        .miners = 3, .threads = 2, .rounds = 100, .end_ns = 0, .seed = 1,
+        .hash_ns = 1.0, .jitter = 0.05, .signal_ns = 5000, .lock_ns = 1000,
+        .thread_ns = 50000, .mq_ns = 20000, .trace = 0
+    };
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--miners=", 9) && (cfg->miners = atoi(argv[i] + 9)) > 0 && cfg->miners <= MAX_MINERS)
+            continue;
+        else if (!strncmp(argv[i], "--threads=", 10) && (cfg->threads = atoi(argv[i] + 10)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--rounds=", 9) && (cfg->rounds = atol(argv[i] + 9)) > 0)
+            cfg->end_ns = 0;
+        else if (!strncmp(argv[i], "--seconds=", 10) && atof(argv[i] + 10) > 0) {
+            cfg->end_ns = atof(argv[i] + 10) * 1e9;
+            cfg->rounds = 0;
+        }
+        else if (!strncmp(argv[i], "--seed=", 7))
+            cfg->seed = strtoull(argv[i] + 7, NULL, 10);
+        else if (!strncmp(argv[i], "--hash-ns=", 10) && (cfg->hash_ns = atof(argv[i] + 10)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--jitter=", 9) && (cfg->jitter = atof(argv[i] + 9) / 100) >= 0 && cfg->jitter < 1)
+            continue;
+        else if (!strncmp(argv[i], "--signal-ns=", 12))
+            cfg->signal_ns = strtoull(argv[i] + 12, NULL, 10);
+        else if (!strncmp(argv[i], "--lock-ns=", 10))
+            cfg->lock_ns = strtoull(argv[i] + 10, NULL, 10);
+        else if (!strncmp(argv[i], "--thread-ns=", 12))
+            cfg->thread_ns = strtoull(argv[i] + 12, NULL, 10);
+        else if (!strncmp(argv[i], "--mq-ns=", 8))
+            cfg->mq_ns = strtoull(argv[i] + 8, NULL, 10);
+        else if (!strncmp(argv[i], "--chain=", 8)) {
+            if ((chain = fopen(argv[i] + 8, "w")) == NULL) {
+                perror("fopen");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--print"))
+            out = &output;
+        else if (!strncmp(argv[i], "--print=", 8) && output_parse_format(argv[i] + 8, &format) == 0)
+            out = &output;
+        else if (!strcmp(argv[i], "--trace"))
+            cfg->trace = 1;
+        else
+            usage(argv[0]);
+    }
+    if (chain) {
+        fflush(chain);
+        if (chain_write_header(fileno(chain), CHAIN_KEYFRAME_INTERVAL) < 0) {
+            perror("write chain");
+            exit(EXIT_FAILURE);
+        }
+        chain_codec_init(&codec, CHAIN_KEYFRAME_INTERVAL);
+    }
+    if (out)
+        output_init(out, STDOUT_FILENO, format);
+
+    sim.rng = cfg->seed ? cfg->seed : SIM_FNV_OFFSET; // xorshift needs a non zero state
+    sim.digest = SIM_FNV_OFFSET;
+    sim.heap_size = SIM_HEAP;
+    if ((sim.heap = malloc(sim.heap_size * sizeof(SimEvent))) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // every miner registered, the first one starts the first round and signals the others
+    for (i = 0; i < cfg->miners; i++) {
+        sim.miners[i].miner.pid = SIM_PID_BASE + i;
+        sim.miners[i].miner.coins = 0;
+        sim.miners[i].miner.wallet = LEDGER_PID_WALLET(sim.miners[i].miner.pid);
+        sim.miners[i].state = S_WAITING;
+        sim.system.miners[sim.system.num_miners++] = sim.miners[i].miner;
+    }
+    init_block(&(sim.system.current_block), -1, 0);
+    sim_solve(&sim);
+    schedule(&sim, 0, EV_START, 0, 0);
+    signal_all(&sim, 0, EV_USR1, sim.system.miners, sim.system.num_miners, sim.miners[0].miner.pid);
+
+    while (next_event(&sim, &ev) == 0) {
+        if (cfg->end_ns && ev.time > cfg->end_ns)
+            break;
+        sim.now = ev.time;
+        sim.events[ev.type]++;
+        fields[0] = ev.time;
+        fields[1] = ev.type;
+        fields[2] = ev.miner;
+        fields[3] = ev.arg;
+        for (k = 0; k < (int)sizeof(fields); k++) // FNV-1a of the event
+            sim.digest = (sim.digest ^ ((uint8_t*)fields)[k]) * SIM_FNV_PRIME;
+        if (cfg->trace)
+            fprintf(stdout, "%14.6f ms  %-8s miner %d  block %d  %d/%d votes\n", ev.time / 1e6, event_names[ev.type],
+                        SIM_PID_BASE + ev.miner, sim.system.current_block.id,
+                        sim.system.current_block.total_votes, sim.system.current_block.num_voters);
+        m = &sim.miners[ev.miner];
+        switch (ev.type) {
+        case EV_START:
+            on_start(&sim, m, ev.miner);
+            break;
+        case EV_FOUND:
+            on_found(&sim, m, ev.miner);
+            break;
+        case EV_USR1:
+            if (m->state == S_WAITING) // outside sigsuspend the signal is lost
+                schedule(&sim, sim.now, EV_START, ev.miner, 0);
+            else
+                sim.lost_usr1++;
+            break;
+        case EV_USR2:
+            if (m->state == S_MINING)
+                m->sigusr2_received = 1;
+            break;
+        case EV_POLL:
+            on_poll(&sim, m, ev.miner, ev.arg, chain, &codec);
+            break;
+        case EV_MONITOR:
+            on_monitor(&sim, out);
+            break;
+        default:
+            break;
+        }
+        if (cfg->rounds && (long)sim.blocks >= cfg->rounds)
+            break;
+    }
+    while (sim.mq_count > 0) // the last blocks are still on their way
+        on_monitor(&sim, out);
+    if (out)
+        output_flush(out);
+    if (chain)
+        fclose(chain);
+
+    fprintf(stdout, "Virtual time:\t%.3f s\n", sim.now / 1e9);
+    fprintf(stdout, "Blocks:\t\t%lu (%lu accepted, %lu verified by the comprobador)\n", (unsigned long)sim.blocks,
+                (unsigned long)sim.accepted, (unsigned long)sim.verified);
+    fprintf(stdout, "Hashes:\t\t%lu\n", (unsigned long)sim.hash_total);
+    fprintf(stdout, "Signals:\t%lu SIGUSR1 (%lu lost), %lu SIGUSR2\n", (unsigned long)sim.events[EV_USR1],
+                (unsigned long)sim.lost_usr1, (unsigned long)sim.events[EV_USR2]);
+    fprintf(stdout, "Messages:\t%lu to the register, %lu to the comprobador (%lu dropped)\n",
+                (unsigned long)sim.pipe_writes, (unsigned long)sim.monitored, (unsigned long)sim.mq_dropped);
+    fprintf(stdout, "Mutex:\t\t%lu acquisitions, %.3f ms held, %.3f ms waited, %.3f us longest wait\n",
+                (unsigned long)sim.locks, sim.lock_hold / 1e6, sim.lock_wait / 1e6, sim.lock_wait_max / 1e3);
+    fprintf(stdout, "Vote polls:\t%lu\n", (unsigned long)sim.events[EV_POLL]);
+    fprintf(stdout, "%-9s %8s %10s %10s %10s %10s %10s  (us)\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+    print_hist("round", &sim.round);
+    print_hist("hashing", &sim.hashing);
+    print_hist("protocol", &sim.protocol);
+    print_hist("vote", &sim.vote);
+    print_hist("ballot", &sim.ballot);
+    fprintf(stdout, "Seed:\t\t%lu\nDigest:\t\t%016lx\n", (unsigned long)cfg->seed, (unsigned long)sim.digest);
+    free(sim.heap);
+    return 0;
+}
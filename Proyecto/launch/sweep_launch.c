@@ -0,0 +1,341 @@
+/**
+ * @file sweep_launch.c
+ * @author Enmanuel, Jorge
+ * @brief scalability sweep: runs the harness over a grid of miners and threads
+ * @version 0.1
+ * @date 2023-05-28
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Every point of the grid (miner processes x threads per miner) is run reps
+ * times with the harness and summarised by the median of the runs. The
+ * speedup of a point is its blocks/s (and hashes/s) over the ones of the
+ * first point, normally 1 miner with 1 thread, and the efficiency divides
+ * the speedup by the workers the point adds. The share of the time the
+ * miners spend waiting for the mutex of the system shows when they start
+ * queueing on it.
+ *
+ * The points go to a CSV and an ASCII plot of the speedup against the
+ * workers. Given a baseline written by an earlier sweep, a point whose
+ * blocks/s fell by more than the threshold fails the run.
+ */
+
+#include "../includes/miner.h"
+#include "../includes/args.h"
+
+#define SWEEP_MAX_LIST 16
+#define SWEEP_MAX_REPS 15
+#define SWEEP_MAX_POINTS (SWEEP_MAX_LIST * SWEEP_MAX_LIST)
+#define SWEEP_PLOT_WIDTH 60
+#define SWEEP_PLOT_HEIGHT 20
+#define SWEEP_LINE 4096
+
+/**
+ * @brief columns of the harness report that the sweep reads
+ */
+typedef enum _column{
+    COL_BLOCKS, // blocks_per_sec
+    COL_HASHES, // hashes_per_sec
+    COL_CPU, // cpu_pct
+    COL_LOCK, // lock_wait_pct
+    COL_ROUND, // round_p50_us
+    NUM_COLUMNS
+} Column;
+
+static const char *column_names[NUM_COLUMNS] = {"blocks_per_sec", "hashes_per_sec", "cpu_pct", "lock_wait_pct", "round_p50_us"};
+
+/**
+ * @brief one point of the grid
+ */
+typedef struct _point{
+    int miners;
+    int threads;
+    int reps;
+    double values[NUM_COLUMNS]; // medians of the runs
+    double speedup; // blocks/s over the first point
+    double hash_speedup; // hashes/s over the first point
+    double efficiency; // speedup over the workers added
+} Point;
+
+volatile sig_atomic_t shutdown = 0;
+
+void signal_handler(int sig) {
+    shutdown = 1;
+}
+
+static int by_value(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int n) {
+    qsort(values, n, sizeof(double), by_value);
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/**
+ * @brief private function that reads the columns of the sweep from a harness report
+ * @return int 0 on success, -1 if the report is not there or incomplete
+ */
+static int read_report(const char *path, double *values) {
+    char header[SWEEP_LINE], line[SWEEP_LINE], *field, *save;
+    int index[NUM_COLUMNS], c, i, found = 0;
+    FILE *file;
+
+    if ((file = fopen(path, "r")) == NULL)
+        return -1;
+    if (!fgets(header, sizeof(header), file) || !fgets(line, sizeof(line), file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    for (c = 0; c < NUM_COLUMNS; c++)
+        index[c] = -1;
+    for (i = 0, field = strtok_r(header, ",\n", &save); field; i++, field = strtok_r(NULL, ",\n", &save))
+        for (c = 0; c < NUM_COLUMNS; c++)
+            if (!strcmp(field, column_names[c]))
+                index[c] = i;
+    for (i = 0, field = strtok_r(line, ",\n", &save); field; i++, field = strtok_r(NULL, ",\n", &save)) {
+        for (c = 0; c < NUM_COLUMNS; c++) {
+            if (index[c] == i) {
+                values[c] = atof(field);
+                found++;
+            }
+        }
+    }
+    return found == NUM_COLUMNS ? 0 : -1;
+}
+
+/**
+ * @brief private function that runs the harness once
+ * @return int 0 on success, -1 on error
+ */
+static int run_harness(const char *harness, int miners, int threads, int seconds, const char *path) {
+    char arg_miners[32], arg_threads[32], arg_seconds[32], arg_out[300];
+    int status;
+    pid_t pid;
+
+    snprintf(arg_miners, sizeof(arg_miners), "--miners=%d", miners);
+    snprintf(arg_threads, sizeof(arg_threads), "--threads=%d", threads);
+    snprintf(arg_seconds, sizeof(arg_seconds), "--seconds=%d", seconds);
+    snprintf(arg_out, sizeof(arg_out), "--out=%s", path);
+    unlink(path); // one report per run
+    if ((pid = fork()) == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        execl(harness, harness, arg_miners, arg_threads, arg_seconds, arg_out, (char*)NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? 0 : -1;
+}
+
+/**
+ * @brief private function that draws the speedup of every miner count against the workers
+ */
+static void plot(FILE *file, const Point *points, int n, const long *miners, int num_miners) {
+    char grid[SWEEP_PLOT_HEIGHT][SWEEP_PLOT_WIDTH + 1];
+    double max_x = 1, max_y = 1, workers;
+    int i, m, x, y;
+
+    for (i = 0; i < n; i++) {
+        workers = points[i].miners * points[i].threads;
+        if (workers > max_x)
+            max_x = workers;
+        if (points[i].speedup > max_y)
+            max_y = points[i].speedup;
+    }
+    if (max_x > max_y) // room for the ideal line
+        max_y = max_x;
+    memset(grid, ' ', sizeof(grid));
+    for (x = 0; x < SWEEP_PLOT_WIDTH; x++) { // ideal: speedup == workers
+        y = (int)((1 + x * (max_x - 1) / (SWEEP_PLOT_WIDTH - 1)) / max_y * (SWEEP_PLOT_HEIGHT - 1) + 0.5);
+        grid[SWEEP_PLOT_HEIGHT - 1 - y][x] = '.';
+    }
+    for (i = 0; i < n; i++) {
+        for (m = 0; m < num_miners && miners[m] != points[i].miners; m++)
+            ;
+        x = max_x > 1 ? (int)((points[i].miners * points[i].threads - 1) / (max_x - 1) * (SWEEP_PLOT_WIDTH - 1) + 0.5) : 0;
+        y = (int)(points[i].speedup / max_y * (SWEEP_PLOT_HEIGHT - 1) + 0.5);
+        grid[SWEEP_PLOT_HEIGHT - 1 - y][x] = m < 9 ? '1' + m : '*';
+    }
+    fprintf(file, "speedup (blocks/s) against workers (miners x threads), '.' is ideal\n");
+    for (y = 0; y < SWEEP_PLOT_HEIGHT; y++) {
+        grid[y][SWEEP_PLOT_WIDTH] = '\0';
+        fprintf(file, "%7.2f |%s\n", max_y * (SWEEP_PLOT_HEIGHT - 1 - y) / (SWEEP_PLOT_HEIGHT - 1), grid[y]);
+    }
+    fprintf(file, "        +");
+    for (x = 0; x < SWEEP_PLOT_WIDTH; x++)
+        fputc('-', file);
+    fprintf(file, "\n         1%*.0f\n", SWEEP_PLOT_WIDTH - 1, max_x);
+    for (m = 0; m < num_miners; m++)
+        fprintf(file, "  %c: %ld miner%s", m < 9 ? '1' + m : '*', miners[m], miners[m] > 1 ? "s" : "");
+    fprintf(file, "\n");
+}
+
+/**
+ * @brief private function that reads the points of an earlier sweep
+ * @return int number of points, -1 if it cannot be read
+ */
+static int load_points(const char *path, Point *points) {
+    char line[SWEEP_LINE];
+    int n = 0;
+    FILE *file;
+    if ((file = fopen(path, "r")) == NULL)
+        return -1;
+    while (n < SWEEP_MAX_POINTS && fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%d,%d,%d,%lf", &points[n].miners, &points[n].threads, &points[n].reps,
+                    &points[n].values[COL_BLOCKS]) == 4)
+            n++; // the header does not parse
+    }
+    fclose(file);
+    return n;
+}
+
+static void usage(const char *name) {
+    fprintf(stdout, "Usage: %s [--miners=N,...] [--threads=N,...] [--reps=N] [--seconds=S]\n"
+                    "       [--out=FILE] [--plot=FILE] [--baseline=FILE] [--threshold=PCT]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main function for the sweep
+ * @return 0 Exit success, 1 on error or if a point got slower than the baseline
+ */
+int main(int argc, char *argv[]) {
+    static Point points[SWEEP_MAX_POINTS], baseline[SWEEP_MAX_POINTS];
+    long miners[SWEEP_MAX_LIST] = {1, 2, 4}, threads[SWEEP_MAX_LIST] = {1, 2, 4, 8};
+    int num_miners = 3, num_threads = 4, reps = 3, seconds = 5, n = 0, num_baseline = 0, regressions = 0;
+    int i, m, t, r, c, ok;
+    double samples[NUM_COLUMNS][SWEEP_MAX_REPS], values[NUM_COLUMNS], threshold = 10, delta;
+    char harness[300] = "./harness", report[] = "/tmp/sweep_XXXXXX", *out = NULL, *plot_path = NULL, *base = NULL;
+    char *slash;
+    struct sigaction act;
+    FILE *file;
+
+    if ((slash = strrchr(argv[0], '/')) != NULL) // the harness is next to this program
+        snprintf(harness, sizeof(harness), "%.*s/harness", (int)(slash - argv[0]), argv[0]);
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--miners=", 9) && (num_miners = parse_list(argv[i] + 9, miners, SWEEP_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--threads=", 10) && (num_threads = parse_list(argv[i] + 10, threads, SWEEP_MAX_LIST)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--reps=", 7) && (reps = atoi(argv[i] + 7)) > 0 && reps <= SWEEP_MAX_REPS)
+            continue;
+        else if (!strncmp(argv[i], "--seconds=", 10) && (seconds = atoi(argv[i] + 10)) > 0)
+            continue;
+        else if (!strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else if (!strncmp(argv[i], "--plot=", 7))
+            plot_path = argv[i] + 7;
+        else if (!strncmp(argv[i], "--baseline=", 11))
+            base = argv[i] + 11;
+        else if (!strncmp(argv[i], "--threshold=", 12) && (threshold = atof(argv[i] + 12)) > 0)
+            continue;
+        else
+            usage(argv[0]);
+    }
+    if (base && (num_baseline = load_points(base, baseline)) == -1)
+        fprintf(stdout, "no baseline in %s\n", base);
+
+    act.sa_handler = signal_handler;
+    act.sa_flags = 0;
+    sigemptyset(&(act.sa_mask));
+    if (sigaction(SIGINT, &act, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+    if ((i = mkstemp(report)) == -1) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    close(i);
+
+    fprintf(stdout, "%6s %7s %12s %14s %8s %8s %8s %7s %11s %9s\n", "miners", "threads", "blocks/s", "hashes/s",
+                "speedup", "hash sp.", "effic.", "lock%", "round p50", "baseline");
+    for (m = 0; m < num_miners && !shutdown; m++) {
+        for (t = 0; t < num_threads && !shutdown; t++) {
+            for (r = 0, ok = 0; r < reps && !shutdown; r++) {
+                if (run_harness(harness, miners[m], threads[t], seconds, report) == -1 ||
+                            read_report(report, values) == -1) {
+                    fprintf(stdout, "run %d of %ld miners x %ld threads failed\n", r + 1, miners[m], threads[t]);
+                    continue;
+                }
+                for (c = 0; c < NUM_COLUMNS; c++)
+                    samples[c][ok] = values[c];
+                ok++;
+            }
+            if (ok == 0)
+                continue;
+            points[n].miners = miners[m];
+            points[n].threads = threads[t];
+            points[n].reps = ok;
+            for (c = 0; c < NUM_COLUMNS; c++)
+                points[n].values[c] = median(samples[c], ok);
+            // relative to the first point, normally 1 miner with 1 thread
+            points[n].speedup = points[0].values[COL_BLOCKS] > 0 ?
+                        points[n].values[COL_BLOCKS] / points[0].values[COL_BLOCKS] : 0;
+            points[n].hash_speedup = points[0].values[COL_HASHES] > 0 ?
+                        points[n].values[COL_HASHES] / points[0].values[COL_HASHES] : 0;
+            points[n].efficiency = points[n].speedup * points[0].miners * points[0].threads /
+                        (points[n].miners * points[n].threads);
+            fprintf(stdout, "%6d %7d %12.3f %14.0f %8.2f %8.2f %8.2f %7.3f %11.0f", points[n].miners,
+                        points[n].threads, points[n].values[COL_BLOCKS], points[n].values[COL_HASHES],
+                        points[n].speedup, points[n].hash_speedup, points[n].efficiency,
+                        points[n].values[COL_LOCK], points[n].values[COL_ROUND]);
+            for (i = 0; i < num_baseline; i++) {
+                if (baseline[i].miners != points[n].miners || baseline[i].threads != points[n].threads)
+                    continue;
+                // positive is slower
+                delta = baseline[i].values[COL_BLOCKS] > 0 ? 100 * (baseline[i].values[COL_BLOCKS] -
+                            points[n].values[COL_BLOCKS]) / baseline[i].values[COL_BLOCKS] : 0;
+                fprintf(stdout, " %+8.1f%%", -delta);
+                if (delta > threshold) {
+                    fprintf(stdout, " SLOWER");
+                    regressions++;
+                }
+                break;
+            }
+            fprintf(stdout, "\n");
+            fflush(stdout);
+            n++;
+        }
+    }
+    unlink(report);
+    if (n == 0) {
+        fprintf(stdout, "no point could be measured\n");
+        exit(EXIT_FAILURE);
+    }
+
+    plot(stdout, points, n, miners, num_miners);
+    if (plot_path) {
+        if ((file = fopen(plot_path, "w")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        plot(file, points, n, miners, num_miners);
+        fclose(file);
+    }
+    if (out) {
+        if ((file = fopen(out, "w")) == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(file, "miners,threads,reps,blocks_per_sec,hashes_per_sec,cpu_pct,lock_wait_pct,round_p50_us,"
+                      "speedup,hash_speedup,efficiency\n");
+        for (i = 0; i < n; i++)
+            fprintf(file, "%d,%d,%d,%.4f,%.0f,%.1f,%.3f,%.0f,%.3f,%.3f,%.3f\n", points[i].miners, points[i].threads,
+                        points[i].reps, points[i].values[COL_BLOCKS], points[i].values[COL_HASHES],
+                        points[i].values[COL_CPU], points[i].values[COL_LOCK], points[i].values[COL_ROUND],
+                        points[i].speedup, points[i].hash_speedup, points[i].efficiency);
+        fclose(file);
+    }
+    if (regressions)
+        fprintf(stdout, "%d points slower than the baseline by more than %.1f%%\n", regressions, threshold);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file trace_launch.c
+ * @author Enmanuel, Jorge
+ * @brief merges the trace rings of the miners and the monitor into a Chrome trace
+ * @version 0.1
+ * @date 2023-05-30
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * trace --start creates the trace segment, the miners and the comprobador
+ * started after it record the phases of every round in their rings. trace
+ * --out=FILE merges the rings in the Chrome trace event format, readable by
+ * chrome://tracing and ui.perfetto.dev: a process per ring, a slice per
+ * phase with the block id as argument, and flow arrows between the phases
+ * of different processes that wait on each other (the broadcast of the
+ * winner and the votes, its MQ send and the publish of the comprobador,
+ * its rollover and the next target fetch of the others), which is the
+ * critical path of a block. trace --reset removes the segment.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "../includes/trace.h"
+
+#define MAX_OPEN 8 // nested phases of a thread
+
+/**
+ * @brief a phase of a process, or an instant if dur is negative
+ */
+typedef struct _slice{
+    pid_t pid;
+    uint8_t tid;
+    uint16_t name;
+    int32_t block;
+    uint64_t ts;
+    int64_t dur;
+} Slice;
+
+/**
+ * @brief a phase of a process that another process waits for
+ */
+typedef struct _flowRule{
+    TraceName from;
+    TraceName to;
+    int next; // the waiting phase belongs to the next block
+} FlowRule;
+
+static const FlowRule rules[] = {
+    {TRACE_BROADCAST, TRACE_VOTE, 0},
+    {TRACE_MQ, TRACE_PUBLISH, 0},
+    {TRACE_ROLLOVER, TRACE_TARGET, 1}
+};
+
+static Slice *slices = NULL;
+static int num_slices = 0, max_slices = 0;
+
+void usage(const char *name) {
+    fprintf(stdout, "Usage: %s --start | --out=FILE | --reset\n", name);
+    exit(EXIT_FAILURE);
+}
+
+void add_slice(const TraceRing *ring, const TraceEvent *event, int64_t dur) {
+    if (num_slices == max_slices) {
+        max_slices = max_slices ? 2 * max_slices : 4096;
+        if ((slices = realloc(slices, max_slices * sizeof(Slice))) == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    slices[num_slices++] = (Slice){ring->pid, event->tid, event->name, event->block, event->ts, dur};
+}
+
+/**
+ * @brief private function that pairs the begin and end events of a ring into slices
+ * @param ring ring
+ * @param events its events, oldest first
+ * @param n events
+ */
+void pair_events(const TraceRing *ring, const TraceEvent *events, int n) {
+    static int open[256][MAX_OPEN], depth[256];
+    int i, d, tid;
+
+    memset(depth, 0, sizeof(depth));
+    for (i = 0; i < n; i++) {
+        tid = events[i].tid;
+        if (events[i].ph == 'i')
+            add_slice(ring, &events[i], -1);
+        else if (events[i].ph == 'B') {
+            if (depth[tid] < MAX_OPEN)
+                open[tid][depth[tid]++] = i;
+        } else { // the end closes the last begin of the same phase, older ones were lost
+            for (d = depth[tid] - 1; d >= 0 && events[open[tid][d]].name != events[i].name; d--)
+                ;
+            if (d < 0)
+                continue; // its begin was overwritten
+            add_slice(ring, &events[open[tid][d]], events[i].ts - events[open[tid][d]].ts);
+            depth[tid] = d;
+        }
+    }
+}
+
+int by_block(const void *a, const void *b) {
+    const Slice *x = a, *y = b;
+    if (x->block != y->block)
+        return x->block < y->block ? -1 : 1;
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+/**
+ * @brief private function that finds the first slice of a block, slices sorted by block
+ * @return int index, num_slices if there is none
+ */
+int first_of(int32_t block) {
+    int lo = 0, hi = num_slices, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (slices[mid].block < block)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief private function that writes the trace, times in us from the first event
+ * @param out file
+ * @param segment trace segment
+ * @return int flow arrows written
+ */
+int write_trace(FILE *out, const TraceSegment *segment) {
+    uint64_t t0 = UINT64_MAX;
+    const Slice *s, *t;
+    int i, j, r, flows = 0;
+    const char *sep = "";
+
+    for (i = 0; i < num_slices; i++)
+        if (slices[i].ts < t0)
+            t0 = slices[i].ts;
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (i = 0; i < TRACE_PROCS && segment->rings[i].pid; i++) {
+        fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                    sep, segment->rings[i].pid, segment->rings[i].role, segment->rings[i].pid);
+        sep = ",\n";
+    }
+    for (i = 0; i < num_slices; i++) {
+        s = &slices[i];
+        fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"round\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,", sep,
+                    trace_names[s->name], s->pid, s->tid, (s->ts - t0) / 1e3);
+        if (s->dur < 0)
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",");
+        else
+            fprintf(out, "\"ph\":\"X\",\"dur\":%.3f,", s->dur / 1e3);
+        fprintf(out, "\"args\":{\"block\":%d}}", s->block);
+        sep = ",\n";
+    }
+    // flows, from the phase of one process to the phases of the others waiting for it
+    for (i = 0; i < num_slices; i++) {
+        s = &slices[i];
+        for (r = 0; r < sizeof(rules) / sizeof(rules[0]); r++) {
+            if (s->name != rules[r].from || s->dur < 0)
+                continue;
+            for (j = first_of(s->block + rules[r].next); j < num_slices &&
+                        slices[j].block == s->block + rules[r].next; j++) {
+                t = &slices[j];
+                if (t->name != rules[r].to || t->pid == s->pid || t->ts < s->ts || t->dur < 0)
+                    continue;
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":%d,\"pid\":%d,\"tid\":%d,"
+                            "\"ts\":%.3f}", trace_names[s->name], flows, s->pid, s->tid, (s->ts - t0) / 1e3);
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%d,\"pid\":%d,"
+                            "\"tid\":%d,\"ts\":%.3f}", trace_names[s->name], flows, t->pid, t->tid, (t->ts - t0) / 1e3);
+                flows++;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return flows;
+}
+
+/**
+ * @brief Main function for trace
+ * @return 0 Exit success or 1 Exit failure
+ */
+int main(int argc, char *argv[]) {
+    static TraceEvent events[TRACE_EVENTS];
+    TraceSegment *segment;
+    const char *path = NULL;
+    FILE *out;
+    int n, procs, flows;
+
+    if (argc != 2)
+        usage(argv[0]);
+    if (!strcmp(argv[1], "--start")) {
+        if ((segment = trace_attach(1, 1)) == NULL) {
+            perror("trace_attach");
+            exit(EXIT_FAILURE);
+        }
+        munmap(segment, sizeof(TraceSegment));
+        fprintf(stdout, "tracing the miners and monitors started from now on\n");
+        return 0;
+    }
+    if (!strcmp(argv[1], "--reset")) {
+        if (shm_unlink(TRACE_SHM) == -1 && errno != ENOENT) {
+            perror("shm_unlink");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+    if (strncmp(argv[1], "--out=", 6))
+        usage(argv[0]);
+    path = argv[1] + 6;
+
+    if ((segment = trace_attach(0, 0)) == NULL) {
+        fprintf(stdout, "no trace, start one with %s --start\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (procs = 0; procs < TRACE_PROCS && segment->rings[procs].pid; procs++) {
+        n = trace_snapshot(&segment->rings[procs], events);
+        pair_events(&segment->rings[procs], events, n);
+    }
+    qsort(slices, num_slices, sizeof(Slice), by_block);
+    if ((out = fopen(path, "w")) == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    flows = write_trace(out, segment);
+    fclose(out);
+    munmap(segment, sizeof(TraceSegment));
+    free(slices);
+    fprintf(stdout, "%d processes, %d events, %d flows written to %s\n", procs, num_slices, flows, path);
+    return 0;
+}
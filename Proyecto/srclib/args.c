@@ -0,0 +1,14 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../includes/args.h"
+
+int parse_list(char *text, long *values, int max) {
+    char *token;
+    int n = 0;
+    for (token = strtok(text, ","); token; token = strtok(NULL, ",")) {
+        if (n == max || (values[n] = atol(token)) <= 0)
+            return -1;
+        n++;
+    }
+    return n;
+}
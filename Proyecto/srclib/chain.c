@@ -0,0 +1,300 @@
+#include "../includes/chain.h"
+
+/* ----------------------------------------- VARINTS ---------------------------------------- */
+
+static size_t put_varint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static long get_varint(const uint8_t *in, size_t len, uint64_t *value) {
+    uint64_t result = 0;
+    size_t n = 0;
+    int shift = 0;
+    while (n < len && shift < 64) {
+        result |= (uint64_t)(in[n] & 0x7f) << shift;
+        if (!(in[n++] & 0x80)) {
+            *value = result;
+            return n;
+        }
+        shift += 7;
+    }
+    return -1; // truncated or longer than 64 bits
+}
+
+static size_t put_zigzag(uint8_t *out, int64_t value) {
+    return put_varint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static long get_zigzag(const uint8_t *in, size_t len, int64_t *value) {
+    uint64_t raw;
+    long n = get_varint(in, len, &raw);
+    if (n > 0)
+        *value = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+    return n;
+}
+
+/* ----------------------------------------- RECORDS ---------------------------------------- */
+
+/* reader over a record payload, any overrun turns ok to 0 */
+typedef struct _cursor{
+    const uint8_t *in;
+    size_t len;
+    size_t pos;
+    uint8_t ok;
+} Cursor;
+
+static uint64_t read_u(Cursor *c) {
+    uint64_t value = 0;
+    long n;
+    if (!c->ok) return 0;
+    n = get_varint(c->in + c->pos, c->len - c->pos, &value);
+    if (n < 0) { c->ok = 0; return 0; }
+    c->pos += n;
+    return value;
+}
+
+static int64_t read_s(Cursor *c) {
+    int64_t value = 0;
+    long n;
+    if (!c->ok) return 0;
+    n = get_zigzag(c->in + c->pos, c->len - c->pos, &value);
+    if (n < 0) { c->ok = 0; return 0; }
+    c->pos += n;
+    return value;
+}
+
+static uint8_t read_byte(Cursor *c) {
+    if (!c->ok || c->pos >= c->len) { c->ok = 0; return 0; }
+    return c->in[c->pos++];
+}
+
+void chain_codec_init(ChainCodec *codec, uint32_t keyframe_interval) {
+    memset(codec, 0, sizeof(ChainCodec));
+    codec->keyframe_interval = keyframe_interval ? keyframe_interval : CHAIN_KEYFRAME_INTERVAL;
+}
+
+static size_t encode_key(const Block *block, uint8_t *out) {
+    size_t n = 0;
+    uint8_t i;
+    n += put_varint(out + n, (uint16_t)block->id);
+    n += put_zigzag(out + n, block->target);
+    n += put_zigzag(out + n, block->solution);
+    n += put_zigzag(out + n, block->winner);
+    out[n++] = block->num_voters;
+    out[n++] = block->total_votes;
+    out[n++] = block->favorable_votes;
+    for (i = 0; i < block->num_voters && i < MAX_MINERS; i++) {
+        n += put_zigzag(out + n, block->miners[i].pid);
+        n += put_zigzag(out + n, block->miners[i].coins);
+    }
+    return n;
+}
+
+static size_t encode_delta(const Block *prev, const Block *block, uint8_t *out) {
+    size_t n = 0;
+    uint8_t i = 0, j, run, count = block->num_voters, prev_count = prev->num_voters;
+    const Miner *base;
+    Miner none = {0, 0};
+
+    if (count > MAX_MINERS) count = MAX_MINERS;
+    if (prev_count > MAX_MINERS) prev_count = MAX_MINERS;
+    n += put_zigzag(out + n, (short)(block->id - prev->id - 1));
+    n += put_zigzag(out + n, block->target - prev->solution);
+    n += put_zigzag(out + n, block->solution);
+    n += put_zigzag(out + n, (int64_t)block->winner - prev->winner);
+    out[n++] = block->num_voters;
+    out[n++] = block->total_votes;
+    out[n++] = block->favorable_votes;
+    // wallets: runs copied from the same position of the previous block,
+    // each run followed by one explicit entry referencing the previous wallets
+    while (i < count) {
+        for (run = 0; i + run < count && i + run < prev_count; run++)
+            if (block->miners[i + run].pid != prev->miners[i + run].pid ||
+                block->miners[i + run].coins != prev->miners[i + run].coins)
+                break;
+        n += put_varint(out + n, run);
+        i += run;
+        if (i == count)
+            break;
+        if (i < prev_count && prev->miners[i].pid == block->miners[i].pid) {
+            base = &prev->miners[i];
+            n += put_varint(out + n, 0); // same position
+        } else {
+            for (j = 0; j < prev_count; j++)
+                if (prev->miners[j].pid == block->miners[i].pid)
+                    break;
+            if (j < prev_count) {
+                base = &prev->miners[j];
+                n += put_varint(out + n, j + 2); // moved from position j
+            } else {
+                base = &none;
+                n += put_varint(out + n, 1); // new miner
+                n += put_zigzag(out + n, block->miners[i].pid);
+            }
+        }
+        n += put_zigzag(out + n, block->miners[i].coins - base->coins);
+        i++;
+    }
+    return n;
+}
+
+size_t chain_encode(ChainCodec *codec, const Block *block, uint8_t *out) {
+    uint8_t payload[CHAIN_MAX_RECORD];
+    size_t len, n = 0;
+    uint8_t key = !codec->has_prev || codec->since_key >= codec->keyframe_interval;
+
+    if (key) {
+        len = encode_key(block, payload);
+        codec->since_key = 1;
+    } else {
+        len = encode_delta(&codec->prev, block, payload);
+        codec->since_key++;
+    }
+    out[n++] = key ? CHAIN_TAG_KEY : CHAIN_TAG_DELTA;
+    n += put_varint(out + n, len);
+    memcpy(out + n, payload, len);
+    codec->prev = *block;
+    codec->has_prev = 1;
+    return n + len;
+}
+
+static int decode_key(Cursor *c, Block *block) {
+    uint8_t i;
+    block->id = (short)read_u(c);
+    block->target = read_s(c);
+    block->solution = read_s(c);
+    block->winner = read_s(c);
+    block->num_voters = read_byte(c);
+    block->total_votes = read_byte(c);
+    block->favorable_votes = read_byte(c);
+    if (block->num_voters > MAX_MINERS)
+        return -1;
+    for (i = 0; i < block->num_voters; i++) {
+        block->miners[i].pid = read_s(c);
+        block->miners[i].coins = read_s(c);
+    }
+    return c->ok ? 0 : -1;
+}
+
+static int decode_delta(Cursor *c, const Block *prev, Block *block) {
+    uint64_t run, ref;
+    uint8_t i = 0, prev_count = prev->num_voters;
+    const Miner *base;
+    Miner none = {0, 0};
+
+    if (prev_count > MAX_MINERS) prev_count = MAX_MINERS;
+    block->id = (short)(prev->id + 1 + read_s(c));
+    block->target = prev->solution + read_s(c);
+    block->solution = read_s(c);
+    block->winner = prev->winner + read_s(c);
+    block->num_voters = read_byte(c);
+    block->total_votes = read_byte(c);
+    block->favorable_votes = read_byte(c);
+    if (block->num_voters > MAX_MINERS)
+        return -1;
+    while (c->ok && i < block->num_voters) {
+        run = read_u(c);
+        if (run && (i + run > block->num_voters || i + run > prev_count))
+            return -1;
+        memcpy(&block->miners[i], &prev->miners[i], run * sizeof(Miner));
+        i += run;
+        if (i == block->num_voters)
+            break;
+        ref = read_u(c);
+        if (ref == 0) {
+            if (i >= prev_count) return -1;
+            base = &prev->miners[i];
+            block->miners[i].pid = base->pid;
+        } else if (ref == 1) {
+            base = &none;
+            block->miners[i].pid = read_s(c);
+        } else {
+            if (ref - 2 >= prev_count) return -1;
+            base = &prev->miners[ref - 2];
+            block->miners[i].pid = base->pid;
+        }
+        block->miners[i].coins = base->coins + read_s(c);
+        i++;
+    }
+    return c->ok ? 0 : -1;
+}
+
+long chain_decode(ChainCodec *codec, const uint8_t *in, size_t len, Block *block) {
+    uint64_t payload;
+    long n;
+    Cursor c;
+    int ret;
+
+    if (len < 2 || (in[0] != CHAIN_TAG_KEY && in[0] != CHAIN_TAG_DELTA))
+        return -1;
+    n = get_varint(in + 1, len - 1, &payload);
+    if (n < 0 || payload > len - 1 - n)
+        return -1;
+    c = (Cursor){ .in = in + 1 + n, .len = payload, .pos = 0, .ok = 1 };
+    memset(block, 0, sizeof(Block));
+    if (in[0] == CHAIN_TAG_KEY) {
+        ret = decode_key(&c, block);
+    } else {
+        if (!codec->has_prev) // a delta needs the block before it
+            return -1;
+        ret = decode_delta(&c, &codec->prev, block);
+    }
+    if (ret < 0 || c.pos != c.len)
+        return -1;
+    codec->prev = *block;
+    codec->has_prev = 1;
+    return 1 + n + payload;
+}
+
+long chain_record_span(const uint8_t *in, size_t len, uint8_t *tag) {
+    uint64_t payload;
+    long n;
+    if (len < 2)
+        return -1;
+    n = get_varint(in + 1, len - 1, &payload);
+    if (n < 0 || payload > len - 1 - n)
+        return -1;
+    if (tag)
+        *tag = in[0];
+    return 1 + n + payload;
+}
+
+long chain_next_keyframe(const uint8_t *in, size_t len, size_t offset) {
+    uint8_t tag;
+    long span;
+    while (offset < len) {
+        span = chain_record_span(in + offset, len - offset, &tag);
+        if (span < 0)
+            break;
+        if (tag == CHAIN_TAG_KEY)
+            return offset;
+        offset += span;
+    }
+    return len;
+}
+
+/* ----------------------------------------- HEADER ----------------------------------------- */
+
+int chain_write_header(int fd, uint32_t keyframe_interval) {
+    uint8_t header[CHAIN_HEADER_SIZE];
+    memcpy(header, CHAIN_MAGIC, 4);
+    header[4] = keyframe_interval & 0xff;
+    header[5] = (keyframe_interval >> 8) & 0xff;
+    header[6] = (keyframe_interval >> 16) & 0xff;
+    header[7] = (keyframe_interval >> 24) & 0xff;
+    return write(fd, header, CHAIN_HEADER_SIZE) == CHAIN_HEADER_SIZE ? 0 : -1;
+}
+
+int chain_read_header(const uint8_t *in, size_t len, uint32_t *keyframe_interval) {
+    if (len < CHAIN_HEADER_SIZE || memcmp(in, CHAIN_MAGIC, 4))
+        return -1;
+    if (keyframe_interval)
+        *keyframe_interval = in[4] | in[5] << 8 | in[6] << 16 | (uint32_t)in[7] << 24;
+    return 0;
+}
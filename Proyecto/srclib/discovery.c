@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "../includes/discovery.h"
+
+void futex_wait(uint32_t *addr, uint32_t value) {
+    // shared futex: the word lives in a segment mapped by several processes
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+void futex_wait_timed(uint32_t *addr, uint32_t value, long timeout_ns) {
+    struct timespec timeout = {timeout_ns / 1000000000, timeout_ns % 1000000000};
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, &timeout, NULL, 0); // relative timeout
+}
+
+void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief private function that opens the segment if it exists and is big enough
+ * @return int file descriptor, -1 if not there yet
+ */
+static int try_open(const char *name, int oflag, size_t size) {
+    struct stat st;
+    int fd = shm_open(name, oflag, 0);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || st.st_size < size) { // created, not sized yet
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void *shm_attach(const char *name, size_t size, int create, int writable) {
+    void *segment;
+    struct stat st;
+    int fd = shm_open(name, writable ? O_RDWR | (create ? O_CREAT : 0) : O_RDONLY, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return NULL;
+    // whoever finds it empty sizes it, the new pages are zeroed
+    if (fstat(fd, &st) == -1 || (st.st_size < size &&
+                (!create || !writable || ftruncate(fd, size) == -1))) {
+        close(fd);
+        return NULL;
+    }
+    segment = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return segment == MAP_FAILED ? NULL : segment;
+}
+
+int wait_for_shm(const char *name, int oflag, size_t size, volatile sig_atomic_t *stop) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct timespec poll_time = {0, 10000000};
+    int fd, ifd;
+    ssize_t len;
+
+    // watch first, then look, so the creation cannot be missed
+    ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd != -1 && inotify_add_watch(ifd, SHM_DIR, IN_CREATE | IN_MOVED_TO | IN_MODIFY) == -1) {
+        close(ifd);
+        ifd = -1;
+    }
+    while ((fd = try_open(name, oflag, size)) == -1 && !*stop) {
+        if (ifd == -1) { // no inotify, fall back to a short poll
+            nanosleep(&poll_time, NULL);
+            continue;
+        }
+        // sleep until something is created or resized in /dev/shm, any event is
+        // checked with try_open, the names of the events do not matter
+        len = read(ifd, events, sizeof(events));
+        if (len == -1 && errno != EINTR) {
+            perror("inotify read");
+            break;
+        }
+    }
+    if (ifd != -1)
+        close(ifd);
+    return *stop ? (fd != -1 ? close(fd), -1 : -1) : fd;
+}
+
+int wait_ready(uint32_t *flag, volatile sig_atomic_t *stop) {
+    while (!__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+        if (*stop)
+            return -1;
+        futex_wait(flag, 0);
+    }
+    return 0;
+}
+
+void set_ready(uint32_t *flag) {
+    __atomic_store_n(flag, 1, __ATOMIC_RELEASE);
+    futex_wake(flag);
+}
@@ -0,0 +1,189 @@
+#include "../includes/format.h"
+
+/* ----------------------------------------- HELPERS ---------------------------------------- */
+
+static char *put_str(char *p, const char *s) {
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+/* decimal with at least width digits, zero padded like %0*ld */
+static char *put_num(char *p, long value, int width) {
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    if (value < 0) {
+        *p++ = '-';
+        width--;
+    }
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (width-- > n)
+        *p++ = '0';
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+/* ----------------------------------------- FORMATS ---------------------------------------- */
+
+static char *format_text(char *p, const Block *b, const BlockInfo *info) {
+    uint8_t i, num_miners = b->total_votes;
+    p = put_str(p, "Id:\t\t");
+    p = put_num(p, b->id, 4);
+    p = put_str(p, "\nWinner:\t\t");
+    p = put_num(p, b->winner, 0);
+    p = put_str(p, "\nTarget:\t\t");
+    p = put_num(p, b->target, 0);
+    p = put_str(p, "\nSolution:\t");
+    p = put_num(p, b->solution, 8);
+    p = put_str(p, "\nVotes:\t\t");
+    p = put_num(p, b->favorable_votes, 0);
+    *p++ = '/';
+    p = put_num(p, num_miners, 0);
+    p = put_str(p, b->favorable_votes == num_miners ? "\t(validated) WidePeepoHappy" : "\t(rejected) pepeHands");
+    if (!info->verified)
+        p = put_str(p, "\t(POW check failed)");
+    p = put_str(p, "\nWallets:");
+    for (i = 0; !info->header_only && i < num_miners && i < MAX_MINERS; i++) {
+        *p++ = '\t';
+        p = put_num(p, b->miners[i].pid, 0);
+        *p++ = ':';
+        p = put_num(p, b->miners[i].coins, 2);
+    }
+    return put_str(p, "\n-----------------------\n");
+}
+
+static char *format_json(char *p, const Block *b, const BlockInfo *info) {
+    uint8_t i;
+    p = put_str(p, "{\"id\":");
+    p = put_num(p, b->id, 0);
+    p = put_str(p, ",\"winner\":");
+    p = put_num(p, b->winner, 0);
+    p = put_str(p, ",\"target\":");
+    p = put_num(p, b->target, 0);
+    p = put_str(p, ",\"solution\":");
+    p = put_num(p, b->solution, 0);
+    p = put_str(p, ",\"favorable_votes\":");
+    p = put_num(p, b->favorable_votes, 0);
+    p = put_str(p, ",\"total_votes\":");
+    p = put_num(p, b->total_votes, 0);
+    p = put_str(p, b->favorable_votes == b->total_votes ? ",\"validated\":true" : ",\"validated\":false");
+    p = put_str(p, info->verified ? ",\"verified\":true" : ",\"verified\":false");
+    if (info->header_only)
+        return put_str(p, "}\n");
+    p = put_str(p, ",\"wallets\":[");
+    for (i = 0; i < b->total_votes && i < MAX_MINERS; i++) {
+        if (i)
+            *p++ = ',';
+        p = put_str(p, "{\"pid\":");
+        p = put_num(p, b->miners[i].pid, 0);
+        p = put_str(p, ",\"coins\":");
+        p = put_num(p, b->miners[i].coins, 0);
+        *p++ = '}';
+    }
+    return put_str(p, "]}\n");
+}
+
+static char *format_csv(char *p, const Block *b, const BlockInfo *info) {
+    p = put_num(p, b->id, 0);
+    *p++ = ',';
+    p = put_num(p, b->winner, 0);
+    *p++ = ',';
+    p = put_num(p, b->target, 0);
+    *p++ = ',';
+    p = put_num(p, b->solution, 0);
+    *p++ = ',';
+    p = put_num(p, b->favorable_votes, 0);
+    *p++ = ',';
+    p = put_num(p, b->total_votes, 0);
+    *p++ = ',';
+    *p++ = b->favorable_votes == b->total_votes ? '1' : '0';
+    *p++ = ',';
+    *p++ = info->verified ? '1' : '0';
+    *p++ = '\n';
+    return p;
+}
+
+/* ----------------------------------------- OUTPUT ----------------------------------------- */
+
+int output_parse_format(const char *name, OutputFormat *format) {
+    if (!strcmp(name, "text"))
+        *format = FORMAT_TEXT;
+    else if (!strcmp(name, "json"))
+        *format = FORMAT_JSON;
+    else if (!strcmp(name, "csv"))
+        *format = FORMAT_CSV;
+    else
+        return -1;
+    return 0;
+}
+
+void output_init(Output *out, int fd, OutputFormat format) {
+    out->fd = fd;
+    out->batch = !isatty(fd);
+    out->format = format;
+    out->len = 0;
+    if (format == FORMAT_CSV) {
+        out->len = put_str(out->buf, "id,winner,target,solution,favorable_votes,total_votes,validated,verified\n") - out->buf;
+        output_flush(out);
+    }
+}
+
+void output_flush(Output *out) {
+    size_t done = 0;
+    ssize_t ret;
+    while (done < out->len) {
+        ret = write(out->fd, out->buf + done, out->len - done);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            break;
+        }
+        done += ret;
+    }
+    out->len = 0;
+}
+
+void output_block(Output *out, const Block *block, const BlockInfo *info) {
+    char *p;
+    if (OUTPUT_SIZE - out->len < OUTPUT_MAX_BLOCK)
+        output_flush(out);
+    p = out->buf + out->len;
+    if (out->format == FORMAT_JSON)
+        p = format_json(p, block, info);
+    else if (out->format == FORMAT_CSV)
+        p = format_csv(p, block, info);
+    else
+        p = format_text(p, block, info);
+    out->len = p - out->buf;
+    if (!out->batch)
+        output_flush(out);
+}
+
+void output_lost(Output *out, int lost) {
+    char *p;
+    if (OUTPUT_SIZE - out->len < OUTPUT_MAX_BLOCK)
+        output_flush(out);
+    p = out->buf + out->len;
+    if (out->format == FORMAT_JSON) {
+        p = put_str(p, "{\"lost\":");
+        p = put_num(p, lost, 0);
+        p = put_str(p, "}\n");
+    } else if (out->format == FORMAT_CSV) {
+        p = put_str(p, "# lost ");
+        p = put_num(p, lost, 0);
+        *p++ = '\n';
+    } else {
+        p = put_str(p, "Lost:\t\t");
+        p = put_num(p, lost, 0);
+        p = put_str(p, " blocks\n-----------------------\n");
+    }
+    out->len = p - out->buf;
+    if (!out->batch)
+        output_flush(out);
+}
@@ -0,0 +1,93 @@
+#include "../includes/history.h"
+
+int history_open(History *history, const char *path, uint8_t writer) {
+    struct stat st;
+    int fd;
+
+    memset(history, 0, sizeof(History));
+    if ((fd = open(path, writer ? O_RDWR | O_CREAT : O_RDONLY, S_IRUSR | S_IWUSR)) == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || (st.st_size < sizeof(HistoryFile) &&
+                (!writer || ftruncate(fd, sizeof(HistoryFile)) == -1))) {
+        close(fd);
+        return -1;
+    }
+    history->file = mmap(NULL, sizeof(HistoryFile), writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (history->file == MAP_FAILED) {
+        history->file = NULL;
+        return -1;
+    }
+    if (memcmp(history->file->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) ||
+                history->file->length != HISTORY_LENGTH || history->file->slot_size != sizeof(HistorySlot)) {
+        if (!writer) {
+            history_close(history);
+            return -1;
+        }
+        // new file, or written by another version: start over
+        memset(history->file, 0, sizeof(HistoryFile));
+        history->file->length = HISTORY_LENGTH;
+        history->file->slot_size = sizeof(HistorySlot);
+        strcpy(history->file->magic, HISTORY_MAGIC);
+    }
+    return 0;
+}
+
+void history_close(History *history) {
+    if (history->file)
+        munmap(history->file, sizeof(HistoryFile));
+    history->file = NULL;
+}
+
+uint64_t history_append(History *history, const Block *block, const BlockInfo *info) {
+    uint64_t seq = history->file->head; // only the writer changes it
+    HistorySlot *slot = &history->file->slots[seq % HISTORY_LENGTH];
+
+    __atomic_store_n(&slot->version, 2 * seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->info = *info;
+    slot->block = *block;
+    __atomic_store_n(&slot->version, 2 * (seq + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&history->file->head, seq + 1, __ATOMIC_RELEASE);
+    return seq;
+}
+
+void history_seek(History *history, int64_t from, uint64_t end) {
+    if (from < 0)
+        from = (uint64_t)-from > end ? 0 : end + from;
+    history->next = (uint64_t)from < end ? (uint64_t)from : end;
+    history->end = end;
+}
+
+int history_read(History *history, Block *block, BlockInfo *info, uint64_t *lost) {
+    HistorySlot *slot;
+    uint64_t head, version;
+
+    while (history->next < history->end) {
+        head = __atomic_load_n(&history->file->head, __ATOMIC_ACQUIRE);
+        if (head > HISTORY_LENGTH && history->next < head - HISTORY_LENGTH) {
+            // overwritten, skip to the oldest block still there
+            *lost += head - HISTORY_LENGTH - history->next;
+            history->next = head - HISTORY_LENGTH;
+            continue;
+        }
+        slot = &history->file->slots[history->next % HISTORY_LENGTH];
+        version = __atomic_load_n(&slot->version, __ATOMIC_ACQUIRE);
+        if (version == 2 * (history->next + 1)) {
+            *info = slot->info;
+            *block = slot->block;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->version, __ATOMIC_RELAXED) == version) {
+                history->next++;
+                return 0;
+            }
+        } else if (version < 2 * (history->next + 1)) {
+            // never written: the file was reset after the range was taken
+            *lost += history->end - history->next;
+            history->next = history->end;
+            break;
+        }
+        // overwritten while reading, look at the head again
+    }
+    return -1;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "../includes/ledger.h"
+#include "../includes/discovery.h"
+
+static uint32_t ledger_slot(uint32_t id) {
+    return (id * 2654435761u) >> (32 - LEDGER_BITS);
+}
+
+/**
+ * @brief private function that finds the entry of a wallet, claiming a free one if create is set
+ * @return LedgerEntry* entry, NULL if not found or the ledger is full
+ */
+static LedgerEntry *ledger_find(Ledger *ledger, uint32_t id, int create) {
+    uint32_t i, slot = ledger_slot(id), owner, empty;
+    LedgerEntry *reuse = NULL; // first tombstone on the way
+    for (i = 0; i < LEDGER_SIZE; i++, slot = (slot + 1) & (LEDGER_SIZE - 1)) {
+        owner = __atomic_load_n(&ledger->entries[slot].id, __ATOMIC_ACQUIRE);
+        if (owner == id)
+            return &ledger->entries[slot];
+        if (owner == LEDGER_TOMBSTONE && reuse == NULL)
+            reuse = &ledger->entries[slot];
+        if (owner != 0)
+            continue;
+        if (!create)
+            return NULL;
+        break;
+    }
+    if (!create)
+        return NULL;
+    // not found, the new wallet takes the first tombstone or the empty slot that ended the search
+    empty = LEDGER_TOMBSTONE;
+    if (reuse != NULL && __atomic_compare_exchange_n(&reuse->id, &empty, id, 0,
+                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&ledger->count, 1, __ATOMIC_RELAXED);
+        return reuse;
+    }
+    for (; i < LEDGER_SIZE; i++, slot = (slot + 1) & (LEDGER_SIZE - 1)) {
+        owner = __atomic_load_n(&ledger->entries[slot].id, __ATOMIC_ACQUIRE);
+        if (owner == id)
+            return &ledger->entries[slot];
+        if (owner != 0)
+            continue;
+        empty = 0;
+        if (__atomic_compare_exchange_n(&ledger->entries[slot].id, &empty, id, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&ledger->count, 1, __ATOMIC_RELAXED);
+            return &ledger->entries[slot];
+        }
+        if (empty == id) // somebody else created it meanwhile
+            return &ledger->entries[slot];
+    }
+    return NULL;
+}
+
+int32_t ledger_credit(Ledger *ledger, uint32_t id, int32_t delta) {
+    LedgerEntry *entry = ledger_find(ledger, id, 1);
+    if (entry == NULL)
+        return -1;
+    return __atomic_add_fetch(&entry->coins, delta, __ATOMIC_RELAXED);
+}
+
+int32_t ledger_balance(const Ledger *ledger, uint32_t id) {
+    LedgerEntry *entry = ledger_find((Ledger*) ledger, id, 0);
+    return entry ? __atomic_load_n(&entry->coins, __ATOMIC_RELAXED) : 0;
+}
+
+void ledger_remove(Ledger *ledger, uint32_t id) {
+    LedgerEntry *entry = ledger_find(ledger, id, 0);
+    if (entry == NULL)
+        return;
+    // zeroed first, whoever reuses the slot starts from nothing
+    __atomic_store_n(&entry->coins, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->id, LEDGER_TOMBSTONE, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&ledger->count, 1, __ATOMIC_RELAXED);
+}
+
+int ledger_sweep(Ledger *ledger) {
+    int i, n = 0;
+    uint32_t id;
+    for (i = 0; i < LEDGER_SIZE; i++) {
+        id = __atomic_load_n(&ledger->entries[i].id, __ATOMIC_ACQUIRE);
+        if (id == LEDGER_TOMBSTONE || !(id & LEDGER_EPHEMERAL))
+            continue;
+        if (kill((pid_t)(id & ~LEDGER_EPHEMERAL), 0) == -1 && errno == ESRCH) {
+            ledger_remove(ledger, id);
+            n++;
+        }
+    }
+    return n;
+}
+
+int ledger_snapshot(const Ledger *ledger, LedgerEntry *out, int max, uint8_t stable) {
+    int i, n = 0;
+    uint32_t id;
+    for (i = 0; i < LEDGER_SIZE && n < max; i++) {
+        id = __atomic_load_n(&ledger->entries[i].id, __ATOMIC_ACQUIRE);
+        if (id == 0 || id == LEDGER_TOMBSTONE || (stable && (id & LEDGER_EPHEMERAL)))
+            continue;
+        out[n].id = id;
+        out[n++].coins = __atomic_load_n(&ledger->entries[i].coins, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+int ledger_read(const char *name, size_t offset, LedgerEntry *out, int max) {
+    size_t size = offset + sizeof(Ledger);
+    void *segment = shm_attach(name, size, 0, 0);
+    int n;
+    if (segment == NULL)
+        return -1;
+    n = ledger_snapshot((const Ledger*)((const char*)segment + offset), out, max, 0);
+    munmap(segment, size);
+    return n;
+}
+
+void ledger_name(uint32_t id, char *name, size_t size) {
+    if (id & LEDGER_EPHEMERAL)
+        snprintf(name, size, "%d", (pid_t)(id & ~LEDGER_EPHEMERAL));
+    else
+        snprintf(name, size, "#%u", id);
+}
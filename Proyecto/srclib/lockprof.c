@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "../includes/lockprof.h"
+#include "../includes/discovery.h"
+
+LockProfile *lockprof_attach(int writable) {
+    return shm_attach(LOCKPROF_SHM, sizeof(LockProfile), writable, writable);
+}
+
+#ifdef LOCKPROF
+
+/**
+ * @brief a lock held by this thread
+ */
+typedef struct _held{
+    sem_t *sem;
+    LockSite *site;
+    uint64_t start;
+} Held;
+
+static LockProfile *profile = NULL;
+static int attach_failed = 0;
+static __thread Held held[LOCKPROF_HELD];
+static __thread int num_held = 0;
+
+/**
+ * @brief private function that finds the site of a call, claiming a free one the first time
+ * @return LockSite* site, NULL if the profile is full or not there
+ */
+static LockSite *find_site(const char *file, int line) {
+    const char *base = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+    uint32_t h = 2166136261u, used, i, n;
+    LockSite *site;
+    const char *c;
+
+    if (profile == NULL && (attach_failed || (profile = lockprof_attach(1)) == NULL)) {
+        attach_failed = 1;
+        return NULL;
+    }
+    for (c = base; *c; c++)
+        h = (h ^ (uint8_t)*c) * 16777619u;
+    h = (h ^ line) * 16777619u;
+    for (n = 0; n < LOCKPROF_SITES; n++) {
+        i = (h + n) % LOCKPROF_SITES;
+        site = &profile->sites[i];
+        used = 0;
+        if (__atomic_compare_exchange_n(&site->used, &used, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            site->line = line;
+            strncpy(site->file, base, LOCKPROF_FILE - 1);
+            __atomic_store_n(&site->used, 2, __ATOMIC_RELEASE);
+            return site;
+        }
+        while (used == 1) // another process is filling it in
+            used = __atomic_load_n(&site->used, __ATOMIC_ACQUIRE);
+        if (site->line == line && !strncmp(site->file, base, LOCKPROF_FILE - 1))
+            return site;
+    }
+    return NULL;
+}
+
+int lockprof_wait_at(sem_t *sem, const char *file, int line) {
+    LockSite *site = find_site(file, line);
+    uint64_t start = now_ns(), acquired;
+    int contended = 0;
+
+    if (sem_trywait(sem) == -1) {
+        contended = 1;
+        if (sem_wait(sem) == -1)
+            return -1;
+    }
+    acquired = now_ns();
+    if (site == NULL)
+        return 0;
+    // the lock is held, nobody else writes this site
+    site->holder = getpid();
+    site->acquisitions++;
+    site->contended += contended;
+    hist_record(&site->wait, acquired - start);
+    if (num_held < LOCKPROF_HELD)
+        held[num_held++] = (Held){sem, site, acquired};
+    return 0;
+}
+
+int lockprof_post(sem_t *sem) {
+    int i;
+    for (i = num_held - 1; i >= 0; i--) {
+        if (held[i].sem != sem)
+            continue;
+        hist_record(&held[i].site->hold, now_ns() - held[i].start);
+        held[i].site->holder = 0;
+        held[i] = held[--num_held];
+        break;
+    }
+    return sem_post(sem);
+}
+
+#endif
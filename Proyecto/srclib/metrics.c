@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "../includes/metrics.h"
+#include "../includes/discovery.h"
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Metrics *metrics_attach() {
+    Metrics *metrics = shm_attach(METRICS_SHM, sizeof(Metrics), 1, 1);
+    if (metrics == NULL)
+        perror("metrics segment");
+    return metrics;
+}
+
+MinerMetrics *metrics_claim(Metrics *metrics, pid_t pid, uint8_t nthreads) {
+    int i;
+    pid_t owner;
+    MinerMetrics *slot;
+    for (i = 0; i < METRICS_MAX_MINERS; i++) {
+        slot = &metrics->miners[i];
+        owner = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+        if (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH))
+            continue; // owner alive
+        if (!__atomic_compare_exchange_n(&slot->pid, &owner, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        // the pid is published first, readers skip slots whose start_ns is 0
+        __atomic_store_n(&slot->start_ns, 0, __ATOMIC_RELEASE);
+        memset((char*)slot + offsetof(MinerMetrics, rounds), 0, sizeof(MinerMetrics) - offsetof(MinerMetrics, rounds));
+        slot->nthreads = nthreads > METRICS_MAX_THREADS ? METRICS_MAX_THREADS : nthreads;
+        __atomic_store_n(&slot->start_ns, now_ns(), __ATOMIC_RELEASE);
+        return slot;
+    }
+    return NULL;
+}
+
+void metrics_release(MinerMetrics *slot) {
+    __atomic_store_n(&slot->start_ns, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->pid, 0, __ATOMIC_RELEASE);
+}
+
+void metrics_add(uint64_t *counter, uint64_t n) {
+    // single writer: a plain load and an atomic store, no locked instruction
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+int hist_bucket(uint64_t value) {
+    int msb, index;
+    if (value < HIST_SUB)
+        return value;
+    msb = 63 - __builtin_clzll(value);
+    index = (msb - HIST_SUB_BITS + 1) * HIST_SUB + (value >> (msb - HIST_SUB_BITS)) - HIST_SUB;
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+uint64_t hist_bucket_value(int index) {
+    if (index < HIST_SUB)
+        return index;
+    return (uint64_t)(index % HIST_SUB + HIST_SUB) << (index / HIST_SUB - 1);
+}
+
+void hist_record(Histogram *hist, uint64_t value) {
+    int index = hist_bucket(value);
+    __atomic_store_n(&hist->buckets[index], hist->buckets[index] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum, hist->sum + value, __ATOMIC_RELAXED);
+    if (value > hist->max)
+        __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+    // count last, a reader never sees more values than buckets hold
+    __atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t hist_percentile(const Histogram *hist, double p) {
+    uint64_t seen = 0, rank;
+    int i;
+    if (hist->count == 0)
+        return 0;
+    rank = (uint64_t)(p / 100.0 * hist->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            return i == hist_bucket(hist->max) ? hist->max : hist_bucket_value(i);
+    }
+    return hist->max;
+}
+
+void hist_merge(Histogram *dst, const Histogram *src) {
+    int i;
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_ACQUIRE);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    if (max > dst->max)
+        dst->max = max;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+}
@@ -1,4 +1,5 @@
 #include "../includes/miner.h"
+#include "../includes/chain.h"
 
 void init_block(Block *block, short last_id, int target) {
     block->id = last_id + 1;
@@ -32,15 +33,30 @@ void delete_miner(Miner *miners, uint8_t *num_miners, pid_t pid) {
 
 void _register(int pipe_read){
     Block _block;
-    uint8_t ret = 0, num_miners = 0, i = 0;
-    char filename[15];
-    int fd;
+    static LedgerEntry wallets[LEDGER_SIZE];
+    char name[16];
+    int num_wallets, w;
+    uint8_t ret = 0, num_miners = 0;
+    char filename[32];
+    int fd, fd_chain;
+    ChainCodec codec; // only the previous block is kept, memory is bounded
+    uint8_t record[CHAIN_MAX_RECORD];
+    size_t record_len;
     sprintf(filename, "reg_%d.txt", getppid());
     fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
     if(fd < 0){
         perror("open");
         exit(EXIT_FAILURE);
     }
+    // compressed binary log of the same blocks
+    sprintf(filename, "chain_%d.bin", getppid());
+    fd_chain = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd_chain < 0 || chain_write_header(fd_chain, CHAIN_KEYFRAME_INTERVAL) < 0){
+        perror("open chain");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    chain_codec_init(&codec, CHAIN_KEYFRAME_INTERVAL);
     while(1){ // read blocks until the pipe is closed
         ret = read(pipe_read, &_block, sizeof(Block));
         if(ret == 0)
@@ -54,18 +70,30 @@ void _register(int pipe_read){
         dprintf(fd, "Id:\t\t\t%04d\nWinner:\t\t%d\nTarget:\t\t%ld\nSolution:\t%08ld\nVotes:\t\t%d/%d",
                     _block.id, _block.winner, _block.target, _block.solution, _block.favorable_votes, num_miners);
         _block.favorable_votes == num_miners ? dprintf(fd, "\t(validated) WidePeepoHappy") : dprintf(fd, "\t(rejected) pepeHands");
+        // balances from the ledger, the coins in the roster of the block are its record for the chain
         dprintf(fd, "\nWallets:");
-        for(i = 0; i < num_miners; i++)
-            dprintf(fd, "\t%d:%02d", _block.miners[i].pid, _block.miners[i].coins);
+        num_wallets = ledger_read(SYSTEM_SHM, offsetof(System, ledger), wallets, LEDGER_SIZE);
+        for(w = 0; w < num_wallets; w++){
+            ledger_name(wallets[w].id, name, sizeof(name));
+            dprintf(fd, "\t%s:%02d", name, wallets[w].coins);
+        }
         dprintf(fd, "\n-----------------------\n");
+        record_len = chain_encode(&codec, &_block, record);
+        if(write(fd_chain, record, record_len) != record_len){
+            perror("write chain");
+            break;
+        }
     }
+    close(fd_chain);
     close(fd);
     exit(0);
 }
 
-void check_args(int argc, char *argv[], uint8_t *n_sec, uint8_t *nthreads){
-    if (argc != 3){
-        fprintf(stdout, "Usage: %s <NSECONDS> <NTHREADS>\n", argv[0]);
+void check_args(int argc, char *argv[], uint8_t *n_sec, uint8_t *nthreads, MinerOptions *opts){
+    int i;
+    if (argc < 3){
+        fprintf(stdout, "Usage: %s <NSECONDS> <NTHREADS|auto> [--resume] [--checkpoint=FILE]"
+                        " [--mq-policy=drop-oldest|coalesce|spill] [--retune] [--wallet=ID]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
     *n_sec = atoi(argv[1]);
@@ -73,10 +101,38 @@ void check_args(int argc, char *argv[], uint8_t *n_sec, uint8_t *nthreads){
         fprintf(stdout, "NSECONDS must be a value between 0 and 60\n");
         exit(EXIT_FAILURE);
     }
-    *nthreads = atoi(argv[2]);
-    if (*nthreads <= 0 || *nthreads > 9){
-        fprintf(stdout, "NTHREADS must be a value between 0 and 9\n");
-        exit(EXIT_FAILURE);
+    memset(opts, 0, sizeof(MinerOptions));
+    if (!strcmp(argv[2], "auto")){ // decided by the calibration
+        opts->auto_tune = 1;
+        *nthreads = 0;
+    } else {
+        *nthreads = atoi(argv[2]);
+        if (*nthreads <= 0 || *nthreads > METRICS_MAX_THREADS){ // one counter line per thread
+            fprintf(stdout, "NTHREADS must be a value between 0 and %d or auto\n", METRICS_MAX_THREADS);
+            exit(EXIT_FAILURE);
+        }
+    }
+    strcpy(opts->checkpoint, CHECKPOINT_FILE);
+    for (i = 3; i < argc; i++){
+        if (!strcmp(argv[i], "--resume"))
+            opts->resume = 1;
+        else if (!strncmp(argv[i], "--checkpoint=", 13) && strlen(argv[i] + 13) > 0
+                    && strlen(argv[i] + 13) < sizeof(opts->checkpoint))
+            strcpy(opts->checkpoint, argv[i] + 13);
+        else if (!strcmp(argv[i], "--mq-policy=drop-oldest"))
+            opts->mq_policy = MQ_DROP_OLDEST;
+        else if (!strcmp(argv[i], "--mq-policy=coalesce"))
+            opts->mq_policy = MQ_COALESCE;
+        else if (!strcmp(argv[i], "--mq-policy=spill"))
+            opts->mq_policy = MQ_SPILL;
+        else if (!strcmp(argv[i], "--retune"))
+            opts->retune = 1;
+        else if (!strncmp(argv[i], "--wallet=", 9) && atol(argv[i] + 9) > 0 && atol(argv[i] + 9) <= LEDGER_MAX_ID)
+            opts->wallet = atol(argv[i] + 9);
+        else {
+            fprintf(stdout, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
     }
 }
 
@@ -110,6 +166,114 @@ System* create_system(){
         exit(EXIT_FAILURE);
     }
     system->monitor_up = 0;
+    system->head_valid = 0;
+    set_ready(&(system->ready)); // wakes the comprobador and the miners that attached early
 
     return system;
-}
\ No newline at end of file
+}
+
+void take_checkpoint(System *system, Checkpoint *ckpt){
+    memset(ckpt, 0, sizeof(Checkpoint));
+    strcpy(ckpt->magic, CHECKPOINT_MAGIC);
+    ckpt->version = CHECKPOINT_VERSION;
+    ckpt->size = sizeof(Checkpoint);
+    ckpt->head = system->last_block;
+    // the wallets of a process are gone with it, only the stable ones are kept
+    ckpt->num_wallets = ledger_snapshot(&(system->ledger), ckpt->wallets, LEDGER_SIZE, 1);
+}
+
+int save_checkpoint(const Checkpoint *ckpt, const char *path){
+    char tmp[80];
+    int fd;
+    // write a temporary file and rename it over the old checkpoint
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1){
+        perror("open checkpoint");
+        return -1;
+    }
+    if(write(fd, ckpt, sizeof(Checkpoint)) != sizeof(Checkpoint) || fsync(fd) == -1){
+        perror("write checkpoint");
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if(rename(tmp, path) == -1){
+        perror("rename checkpoint");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int load_checkpoint(Checkpoint *ckpt, const char *path){
+    int fd;
+    ssize_t n;
+    if((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    n = read(fd, ckpt, sizeof(Checkpoint));
+    close(fd);
+    if(n < (ssize_t)offsetof(Checkpoint, head) || memcmp(ckpt->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))){
+        fprintf(stderr, "%s is not a checkpoint\n", path);
+        return -2;
+    }
+    if(ckpt->version != CHECKPOINT_VERSION || ckpt->size != sizeof(Checkpoint) || n != sizeof(Checkpoint)){
+        fprintf(stderr, "%s is a checkpoint of version %u (%u bytes), this miner reads version %d (%zu bytes)\n",
+                    path, ckpt->version, ckpt->size, CHECKPOINT_VERSION, sizeof(Checkpoint));
+        return -2;
+    }
+    if(ckpt->num_wallets > LEDGER_SIZE){
+        fprintf(stderr, "%s is corrupt, %u wallets\n", path, ckpt->num_wallets);
+        return -2;
+    }
+    return 0;
+}
+
+void round_join(Block *block, const Miner *miner){
+    block->miners[block->num_voters] = *miner;
+    block->num_voters++;
+}
+
+void round_publish(Block *block, long solution){
+    block->solution = solution;
+    block->total_votes++;
+    block->favorable_votes++;
+}
+
+void round_vote(Block *block, long solution){
+    if(block->solution == solution) // if solution is correct in this miner's opinion
+        block->favorable_votes++;
+    block->total_votes++;
+}
+
+int32_t credit_wallet(System *system, uint32_t wallet, int32_t delta){
+    int32_t balance = ledger_credit(&(system->ledger), wallet, delta);
+    if(balance == -1 && ledger_sweep(&(system->ledger)) > 0)
+        balance = ledger_credit(&(system->ledger), wallet, delta);
+    if(balance == -1)
+        fprintf(stderr, "ledger full, %d coins not credited to wallet %u\n", delta, wallet);
+    return balance;
+}
+
+uint8_t round_close(System *system, Miner *winner){
+    Block *block = &(system->current_block);
+    uint8_t i, accepted = block->total_votes == block->favorable_votes;
+    int32_t balance;
+    if(accepted){
+        block->winner = winner->pid;
+        if((balance = credit_wallet(system, winner->wallet, 1)) != -1)
+            winner->coins = balance;
+    }
+    // wallets of the block come from the ledger, not from each voter's own count
+    for(i = 0; i < block->num_voters; i++)
+        block->miners[i].coins = ledger_balance(&(system->ledger), block->miners[i].wallet);
+    return accepted;
+}
+
+void round_next(System *system){
+    Block new_block;
+    system->last_block = system->current_block;
+    system->head_valid = 1;
+    init_block(&new_block, system->last_block.id, system->last_block.solution);
+    system->current_block = new_block;
+}
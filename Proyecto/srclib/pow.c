@@ -1,3 +1,4 @@
+#include <string.h>
 #include "../includes/pow.h"
 
 #define PRIME POW_LIMIT
@@ -7,4 +8,107 @@
 long int pow_hash(long int x) {
   long int result = (x * BIG_X + BIG_Y) % PRIME;
   return result;
-}
\ No newline at end of file
+}
+
+void pow_hash_batch(const long int *x, long int *out, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    out[i] = (x[i] * BIG_X + BIG_Y) % PRIME;
+}
+
+/* The search kernels return -1 when no x in [start, end) hashes to target. */
+
+long int pow_search_scalar(long int start, long int end, long int target) {
+  long int x;
+  for (x = start; x < end; x++)
+    if (pow_hash(x) == target)
+      return x;
+  return -1;
+}
+
+/* f(x + 1) = f(x) + X mod P, so one addition and one compare per x. */
+long int pow_search_incremental(long int start, long int end, long int target) {
+  long int x, h, step = BIG_X % PRIME;
+  if (start >= end)
+    return -1;
+  h = pow_hash(start);
+  for (x = start; x < end; x++) {
+    if (h == target)
+      return x;
+    h += step;
+    if (h >= PRIME)
+      h -= PRIME;
+  }
+  return -1;
+}
+
+__extension__ typedef unsigned __int128 pow_u128;
+
+/* m = floor(2^64 / P), the quotient estimate is at most one short. */
+#define BARRETT_M ((unsigned long)(((pow_u128)1 << 64) / PRIME))
+
+long int pow_search_barrett(long int start, long int end, long int target) {
+  long int x;
+  unsigned long v, q, r;
+  for (x = start; x < end; x++) {
+    v = (unsigned long)x * BIG_X + BIG_Y;
+    q = (unsigned long)(((pow_u128)v * BARRETT_M) >> 64);
+    r = v - q * PRIME;
+    if (r >= PRIME)
+      r -= PRIME;
+    if ((long int)r == target)
+      return x;
+  }
+  return -1;
+}
+
+/* Hashes are below P < 2^27, so 32 bit lanes are enough and every SSE2
+   target has the compares for them. Two 128 bit vectors of 4 lanes each
+   hold POW_SIMD_LANES consecutive x, wider vectors are split into scalar
+   code by the compiler when the target has no AVX. */
+typedef int pow_lanes __attribute__((vector_size(16)));
+
+#define POW_SIMD_BLOCK 16 /* vector steps between checks for a hit */
+
+long int pow_search_simd(long int start, long int end, long int target) {
+  pow_lanes low, high, hits, goal, step, prime;
+  long int x, block = POW_SIMD_LANES * POW_SIMD_BLOCK;
+  int i, lane, any;
+  for (lane = 0; lane < 4; lane++) {
+    low[lane] = pow_hash(start + lane);
+    high[lane] = pow_hash(start + 4 + lane);
+    goal[lane] = target >= 0 && target < PRIME ? target : -1; /* -1 is never hit */
+    step[lane] = POW_SIMD_LANES * (BIG_X % PRIME) % PRIME;
+    prime[lane] = PRIME;
+  }
+  for (x = start; x + block <= end; x += block) {
+    hits = low == goal;
+    for (i = 0; i < POW_SIMD_BLOCK; i++) {
+      hits |= (low == goal) | (high == goal);
+      low += step;
+      high += step;
+      low -= (low >= prime) & prime; /* comparisons give -1 in the lanes where they hold */
+      high -= (high >= prime) & prime;
+    }
+    for (any = 0, lane = 0; lane < 4; lane++)
+      any |= hits[lane];
+    if (any) /* rare, find the first hit of the block */
+      return pow_search_incremental(x, x + block, target);
+  }
+  return pow_search_incremental(x, end, target);
+}
+
+const PowKernel pow_kernels[POW_NUM_KERNELS] = {
+  {"scalar", pow_search_scalar},
+  {"incremental", pow_search_incremental},
+  {"barrett", pow_search_barrett},
+  {"simd", pow_search_simd},
+};
+
+const PowKernel *pow_kernel(const char *name) {
+  int i;
+  for (i = 0; i < POW_NUM_KERNELS; i++)
+    if (!strcmp(pow_kernels[i].name, name))
+      return &pow_kernels[i];
+  return NULL;
+}
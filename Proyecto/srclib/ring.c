@@ -0,0 +1,261 @@
+#include <errno.h>
+#include "../includes/ring.h"
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief private function that returns the cursor of the slowest subscriber
+ * @param shmem segment
+ * @param writing index of the producer, returned when there are no subscribers
+ * @param slowest slowest cursor, NULL if there are no subscribers
+ * @return uint32_t index of the slowest subscriber
+ */
+static uint32_t slowest_reader(SharedMemory *shmem, uint32_t writing, RingCursor **slowest) {
+    uint32_t i, seq, min = writing;
+    *slowest = NULL;
+    for (i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        if (__atomic_load_n(&shmem->readers[i].active, __ATOMIC_ACQUIRE) != 1)
+            continue; // free, or still being set up
+        seq = __atomic_load_n(&shmem->readers[i].seq, __ATOMIC_SEQ_CST);
+        if (writing - seq >= writing - min) { // furthest behind, wrap safe
+            min = seq;
+            *slowest = &shmem->readers[i];
+        }
+    }
+    return min;
+}
+
+/**
+ * @brief private function that frees the cursor of a subscriber whose process is gone
+ * @param shmem segment
+ * @param cursor subscriber cursor
+ */
+static void drop_dead(SharedMemory *shmem, RingCursor *cursor) {
+    uint32_t active = 1;
+    pid_t pid = __atomic_load_n(&cursor->pid, __ATOMIC_RELAXED);
+    if (kill(pid, 0) == 0 || errno != ESRCH)
+        return;
+    if (__atomic_compare_exchange_n(&cursor->active, &active, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        __atomic_sub_fetch(&shmem->using, 1, __ATOMIC_ACQ_REL);
+        fprintf(stderr, "subscriber %d is gone, the ring no longer waits for it\n", pid);
+    }
+}
+
+/**
+ * @brief private function that adapts a spin budget after a wait
+ * @param own cursor holding the budget
+ * @param spun 1 if spinning was enough, 0 if the caller had to sleep
+ */
+static void adapt_spin(RingCursor *own, int spun) {
+    if (spun && own->spin < RING_SPIN_MAX)
+        own->spin *= 2;
+    else if (!spun && own->spin > RING_SPIN_MIN)
+        own->spin /= 2;
+}
+
+/**
+ * @brief private function that copies a block without its wallets
+ */
+static void copy_header(Block *dst, const Block *src) {
+    dst->id = src->id;
+    dst->target = src->target;
+    dst->solution = src->solution;
+    dst->winner = src->winner;
+    dst->num_voters = src->num_voters;
+    dst->total_votes = src->total_votes;
+    dst->favorable_votes = src->favorable_votes;
+    dst->sent_ns = src->sent_ns;
+}
+
+int ring_filter_match(const RingFilter *filter, const Block *block, uint64_t seq) {
+    uint32_t i;
+    if ((filter->flags & RING_REJECTED_ONLY) && block->favorable_votes == block->total_votes)
+        return 0;
+    if (filter->every > 1 && seq % filter->every)
+        return 0;
+    if (filter->num_pids == 0)
+        return 1;
+    for (i = 0; i < filter->num_pids; i++)
+        if (filter->pids[i] == block->winner)
+            return 1;
+    return 0;
+}
+
+void ring_init(SharedMemory *shmem, uint8_t lossy, uint64_t base) {
+    memset(shmem, 0, sizeof(SharedMemory));
+    shmem->writing.spin = RING_SPIN_MIN;
+    shmem->lossy = lossy;
+    shmem->base = base;
+    set_ready(&shmem->ready); // wakes the monitors that attached early
+}
+
+int ring_subscribe(SharedMemory *shmem, const RingFilter *filter) {
+    int i;
+    uint32_t free_cursor;
+    for (i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        free_cursor = 0;
+        if (!__atomic_compare_exchange_n(&shmem->readers[i].active, &free_cursor, 2, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        // the cursor starts at the current head, then becomes visible to the producer
+        shmem->readers[i].seq = __atomic_load_n(&shmem->writing.seq, __ATOMIC_ACQUIRE);
+        shmem->readers[i].waiting = 0;
+        shmem->readers[i].lost = 0;
+        shmem->readers[i].spin = RING_SPIN_MIN;
+        shmem->readers[i].pid = getpid();
+        if (filter)
+            shmem->readers[i].filter = *filter;
+        else
+            memset(&shmem->readers[i].filter, 0, sizeof(RingFilter));
+        __atomic_store_n(&shmem->readers[i].active, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&shmem->using, 1, __ATOMIC_ACQ_REL);
+        return i;
+    }
+    return -1;
+}
+
+void ring_unsubscribe(SharedMemory *shmem, int sub) {
+    __atomic_store_n(&shmem->readers[sub].active, 0, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&shmem->using, 1, __ATOMIC_ACQ_REL);
+    // the producer may be waiting for this cursor
+    if (__atomic_load_n(&shmem->writing.waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&shmem->readers[sub].seq);
+}
+
+int ring_push(SharedMemory *shmem, const Block *block, const BlockInfo *info, volatile sig_atomic_t *stop) {
+    uint32_t i, min, writing = shmem->writing.seq; // only the producer writes it
+    RingCursor *slowest;
+    RingSlot *slot;
+
+    if (!shmem->lossy) {
+        for (i = 0; writing - slowest_reader(shmem, writing, &slowest) >= BUFFER_LENGTH; i++) {
+            if (i < shmem->writing.spin) {
+                cpu_relax();
+                continue;
+            }
+            // sleep on the cursor of the slowest subscriber until it moves
+            __atomic_store_n(&shmem->writing.waiting, 1, __ATOMIC_SEQ_CST);
+            min = slowest_reader(shmem, writing, &slowest);
+            if (writing - min >= BUFFER_LENGTH && slowest != NULL)
+                futex_wait_timed(&slowest->seq, min, RING_LIVENESS_NS);
+            __atomic_store_n(&shmem->writing.waiting, 0, __ATOMIC_RELAXED);
+            if (*stop)
+                return -1;
+            // it did not move, a subscriber killed without unsubscribing would gate the producer forever
+            if (slowest != NULL && __atomic_load_n(&slowest->seq, __ATOMIC_SEQ_CST) == min)
+                drop_dead(shmem, slowest);
+        }
+        if (i > 0)
+            adapt_spin(&shmem->writing, i <= shmem->writing.spin);
+    }
+    slot = &shmem->slots[writing % BUFFER_LENGTH];
+    __atomic_store_n(&slot->version, 2 * writing + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->info = *info;
+    slot->block = *block;
+    // filter once here for every subscriber, they skip what they do not want without copying it
+    slot->filtered = slot->match = 0;
+    for (i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        if (__atomic_load_n(&shmem->readers[i].active, __ATOMIC_ACQUIRE) != 1)
+            continue;
+        slot->filtered |= 1u << i;
+        if (ring_filter_match(&shmem->readers[i].filter, block, shmem->base + writing))
+            slot->match |= 1u << i;
+    }
+    __atomic_store_n(&slot->version, 2 * (writing + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&shmem->writing.seq, writing + 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < RING_MAX_SUBSCRIBERS; i++) {
+        if (__atomic_load_n(&shmem->readers[i].waiting, __ATOMIC_SEQ_CST)) {
+            futex_wake(&shmem->writing.seq);
+            break;
+        }
+    }
+    return 0;
+}
+
+int ring_pop(SharedMemory *shmem, int sub, Block *block, BlockInfo *info, volatile sig_atomic_t *stop) {
+    RingCursor *own = &shmem->readers[sub];
+    uint32_t i, writing, version, reading = own->seq, lost = 0; // only this subscriber writes it
+    uint32_t bit = 1u << sub, take;
+    RingSlot *slot;
+
+    while (1) {
+        for (i = 0; (writing = __atomic_load_n(&shmem->writing.seq, __ATOMIC_ACQUIRE)) == reading; i++) {
+            if (i < own->spin) {
+                cpu_relax();
+                continue;
+            }
+            __atomic_store_n(&own->waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&shmem->writing.seq, __ATOMIC_SEQ_CST) == reading)
+                futex_wait(&shmem->writing.seq, reading);
+            __atomic_store_n(&own->waiting, 0, __ATOMIC_RELAXED);
+            if (*stop)
+                return -1;
+        }
+        if (i > 0)
+            adapt_spin(own, i <= own->spin);
+        if (writing - reading > BUFFER_LENGTH) { // lossy: overwritten, skip to the oldest slot
+            lost += writing - BUFFER_LENGTH - reading;
+            reading = writing - BUFFER_LENGTH;
+        }
+        slot = &shmem->slots[reading % BUFFER_LENGTH];
+        version = __atomic_load_n(&slot->version, __ATOMIC_ACQUIRE);
+        if (version == 2 * (reading + 1)) {
+            // a subscriber that attached after the producer filtered the slot runs its own filter
+            take = slot->filtered & bit ? slot->match & bit :
+                        ring_filter_match(&own->filter, &slot->block, shmem->base + reading);
+            if (take) {
+                *info = slot->info;
+                if (own->filter.flags & RING_HEADER_ONLY) {
+                    copy_header(block, &slot->block);
+                    info->header_only = 1;
+                } else {
+                    *block = slot->block;
+                }
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->version, __ATOMIC_RELAXED) == version) {
+                if (take)
+                    break;
+                // not for this subscriber, free the slot and go on with the next one
+                __atomic_store_n(&own->seq, ++reading, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&shmem->writing.waiting, __ATOMIC_SEQ_CST))
+                    futex_wake(&own->seq);
+                continue;
+            }
+        }
+        // overwritten while reading, look at the head again
+    }
+    own->lost += lost;
+    __atomic_store_n(&own->seq, reading + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shmem->writing.waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&own->seq);
+    return lost;
+}
+
+uint32_t ring_available(SharedMemory *shmem, int sub) {
+    RingCursor *own = &shmem->readers[sub];
+    uint32_t writing = __atomic_load_n(&shmem->writing.seq, __ATOMIC_ACQUIRE), reading = own->seq;
+    uint32_t bit = 1u << sub, n = 0, take;
+    RingSlot *slot;
+
+    if (writing - reading > BUFFER_LENGTH) // overwritten, ring_pop reports them without waiting
+        return writing - reading;
+    for (; reading != writing; reading++) {
+        slot = &shmem->slots[reading % BUFFER_LENGTH];
+        if (__atomic_load_n(&slot->version, __ATOMIC_ACQUIRE) != 2 * (reading + 1))
+            return n + 1; // being overwritten, ring_pop will not wait either
+        take = slot->filtered & bit ? slot->match & bit :
+                    ring_filter_match(&own->filter, &slot->block, shmem->base + reading);
+        n += take != 0;
+    }
+    return n;
+}
+
+uint64_t ring_sequence(SharedMemory *shmem, int sub) {
+    return shmem->base + shmem->readers[sub].seq;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../includes/spawn.h"
+#include "../includes/metrics.h"
+
+void sleep_ms(long ms) {
+    struct timespec t = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&t, NULL);
+}
+
+pid_t spawn(char *const argv[], int group) {
+    pid_t pid = fork();
+    int fd;
+    if (pid != 0)
+        return pid;
+    if (group)
+        setpgid(0, 0);
+    if ((fd = open("/dev/null", O_WRONLY)) != -1) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    execv(argv[0], argv);
+    perror("execv");
+    _exit(EXIT_FAILURE);
+}
+
+void stop_all(pid_t *children, int n, int group, int grace_s, long poll_ms) {
+    int i, left = 0;
+    uint64_t deadline = now_ns() + grace_s * 1000000000ull;
+    for (i = 0; i < n; i++) {
+        if (children[i] > 0) {
+            kill(group ? -children[i] : children[i], SIGINT);
+            left++;
+        }
+    }
+    while (left > 0 && now_ns() < deadline) {
+        for (i = 0; i < n; i++) {
+            if (children[i] > 0 && waitpid(children[i], NULL, WNOHANG) == children[i]) {
+                children[i] = 0;
+                left--;
+            }
+        }
+        sleep_ms(poll_ms);
+    }
+    for (i = 0; i < n; i++) { // stuck, probably waiting for a signal that will never come
+        if (children[i] > 0) {
+            kill(group ? -children[i] : children[i], SIGKILL);
+            waitpid(children[i], NULL, 0);
+            children[i] = 0;
+        }
+    }
+}
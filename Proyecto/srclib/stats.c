@@ -0,0 +1,190 @@
+#include "../includes/stats.h"
+
+/* ----------------------------------------- WINNERS ---------------------------------------- */
+
+/**
+ * @brief private function that finds the slot of a pid, taking a new one if needed
+ * @return WinnerCount* slot, NULL if the table is full
+ */
+static WinnerCount *winner_slot(Stats *stats, pid_t pid) {
+    uint32_t i, h = ((uint32_t)pid * 2654435761u) & (STATS_PIDS - 1);
+    for (i = 0; i < STATS_PIDS; i++, h = (h + 1) & (STATS_PIDS - 1)) {
+        if (stats->winners[h].pid == pid)
+            return &stats->winners[h];
+        if (stats->winners[h].pid == 0) {
+            stats->winners[h].pid = pid;
+            stats->used_winners++;
+            return &stats->winners[h];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief private function that drops the pids without wins in the window
+ */
+static void winners_compact(Stats *stats) {
+    WinnerCount old[STATS_PIDS];
+    int i;
+    memcpy(old, stats->winners, sizeof(old));
+    memset(stats->winners, 0, sizeof(stats->winners));
+    stats->used_winners = 0;
+    for (i = 0; i < STATS_PIDS; i++)
+        if (old[i].wins)
+            winner_slot(stats, old[i].pid)->wins = old[i].wins;
+}
+
+/* ----------------------------------------- WINDOW ----------------------------------------- */
+
+static void window_add(Histogram *hist, uint64_t value) {
+    hist->buckets[hist_bucket(value)]++;
+    hist->sum += value;
+    hist->count++;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+static void window_remove(Histogram *hist, uint64_t value) {
+    hist->buckets[hist_bucket(value)]--;
+    hist->sum -= value;
+    hist->count--;
+}
+
+int stats_init(Stats *stats, uint32_t window) {
+    memset(stats, 0, sizeof(Stats));
+    stats->window = window ? window : STATS_WINDOW;
+    stats->entries = calloc(stats->window, sizeof(StatsEntry));
+    return stats->entries ? 0 : -1;
+}
+
+void stats_free(Stats *stats) {
+    free(stats->entries);
+    stats->entries = NULL;
+}
+
+void stats_add(Stats *stats, const Block *block, const BlockInfo *info, uint64_t now) {
+    StatsEntry *entry = &stats->entries[stats->head % stats->window];
+    WinnerCount *slot;
+
+    if (stats->head >= stats->window) { // the oldest block leaves the window
+        stats->rejected -= entry->rejected;
+        stats->invalid -= entry->invalid;
+        if (entry->winner && (slot = winner_slot(stats, entry->winner)) != NULL && slot->wins)
+            slot->wins--;
+        if (entry->round)
+            window_remove(&stats->rounds, entry->round);
+        if (entry->latency)
+            window_remove(&stats->latency, entry->latency);
+    }
+    entry->round = 0;
+    if (stats->head > 0) {
+        entry->round = (now - stats->entries[(stats->head - 1) % stats->window].arrival) / 1000;
+        if (entry->round == 0)
+            entry->round = 1; // 0 marks the first block
+        stats->round_ewma = stats->head == 1 ? entry->round :
+                    stats->round_ewma + STATS_EWMA_ALPHA * (entry->round - stats->round_ewma);
+        window_add(&stats->rounds, entry->round);
+    }
+    entry->latency = 0;
+    if (block->sent_ns && now > block->sent_ns) {
+        entry->latency = (now - block->sent_ns) / 1000 + 1; // 0 marks unknown
+        window_add(&stats->latency, entry->latency);
+    }
+    entry->arrival = now;
+    entry->rejected = block->favorable_votes != block->total_votes;
+    entry->invalid = !info->verified;
+    stats->rejected += entry->rejected;
+    stats->invalid += entry->invalid;
+    entry->winner = entry->rejected ? 0 : block->winner;
+    if (entry->winner) {
+        if (stats->used_winners > STATS_PIDS * 3 / 4)
+            winners_compact(stats);
+        if ((slot = winner_slot(stats, entry->winner)) != NULL)
+            slot->wins++;
+        else
+            entry->winner = 0; // table full, not counted
+    }
+    if (!info->header_only)
+        stats->last = *block;
+    stats->head++;
+}
+
+void stats_lost(Stats *stats, int lost) {
+    stats->lost += lost;
+}
+
+/* ----------------------------------------- SUMMARY ---------------------------------------- */
+
+/**
+ * @brief private function that returns the blocks per minute
+ */
+static double blocks_per_minute(Stats *stats, uint64_t now) {
+    uint64_t oldest = stats->head > stats->window ? stats->head - stats->window : 0;
+    if (stats->minute_tail < oldest)
+        stats->minute_tail = oldest;
+    // amortized O(1), every block leaves the minute once
+    while (stats->minute_tail < stats->head &&
+                now - stats->entries[stats->minute_tail % stats->window].arrival > STATS_MINUTE)
+        stats->minute_tail++;
+    if (stats->minute_tail == oldest && stats->head - oldest > 1 && stats->head > stats->window) {
+        // the whole window arrived in the last minute, extrapolate
+        return (double)(stats->head - oldest) * STATS_MINUTE /
+                    (now - stats->entries[oldest % stats->window].arrival);
+    }
+    return stats->head - stats->minute_tail;
+}
+
+static int by_wins(const void *a, const void *b) {
+    return (int)((const WinnerCount*)b)->wins - (int)((const WinnerCount*)a)->wins;
+}
+
+static int by_coins(const void *a, const void *b) {
+    return ((const LedgerEntry*)b)->coins - ((const LedgerEntry*)a)->coins;
+}
+
+size_t stats_render(Stats *stats, uint64_t now, const LedgerEntry *wallets, int num_wallets, char *buf, size_t size) {
+    WinnerCount top[STATS_PIDS];
+    static LedgerEntry richest[LEDGER_SIZE];
+    char name[16];
+    uint32_t in_window = stats->head < stats->window ? stats->head : stats->window;
+    uint32_t i, n = 0, wins = 0;
+    size_t len = 0;
+
+#define EMIT(...) len += snprintf(buf + len, len < size ? size - len : 0, __VA_ARGS__)
+    EMIT("Blocks:\t\t%lu (%u in window, %lu lost)\n", (unsigned long)stats->head, in_window, (unsigned long)stats->lost);
+    EMIT("Rate:\t\t%.1f blocks/min\n", blocks_per_minute(stats, now));
+    EMIT("Rejected:\t%.2f%%\tPOW failed: %u\n", in_window ? 100.0 * stats->rejected / in_window : 0.0, stats->invalid);
+    EMIT("Round (ms):\tewma %.2f\tp50 %.2f\tp90 %.2f\tp99 %.2f\n", stats->round_ewma / 1000,
+                hist_percentile(&stats->rounds, 50) / 1000.0, hist_percentile(&stats->rounds, 90) / 1000.0,
+                hist_percentile(&stats->rounds, 99) / 1000.0);
+    if (stats->latency.count)
+        EMIT("Latency (ms):\tmean %.2f\tp50 %.2f\tp90 %.2f\tp99 %.2f\n",
+                    (double)stats->latency.sum / stats->latency.count / 1000,
+                    hist_percentile(&stats->latency, 50) / 1000.0, hist_percentile(&stats->latency, 90) / 1000.0,
+                    hist_percentile(&stats->latency, 99) / 1000.0);
+
+    for (i = 0; i < STATS_PIDS; i++) {
+        if (stats->winners[i].wins) {
+            top[n++] = stats->winners[i];
+            wins += stats->winners[i].wins;
+        }
+    }
+    qsort(top, n, sizeof(WinnerCount), by_wins);
+    EMIT("Winners:");
+    for (i = 0; i < n && i < STATS_TOP; i++)
+        EMIT("\t%d:%.1f%%", top[i].pid, 100.0 * top[i].wins / wins);
+    EMIT("\n");
+
+    if (num_wallets > LEDGER_SIZE)
+        num_wallets = LEDGER_SIZE;
+    memcpy(richest, wallets, num_wallets * sizeof(LedgerEntry));
+    qsort(richest, num_wallets, sizeof(LedgerEntry), by_coins);
+    EMIT("Wallets:");
+    for (i = 0; i < num_wallets && i < STATS_TOP; i++) {
+        ledger_name(richest[i].id, name, sizeof(name));
+        EMIT("\t%s:%02d", name, richest[i].coins);
+    }
+    EMIT("\n-----------------------\n");
+#undef EMIT
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "../includes/trace.h"
+#include "../includes/discovery.h"
+
+const char *trace_names[NUM_TRACE_NAMES] = {
+    "target fetch", "voter registration", "thread start", "scan", "SIGUSR2 broadcast", "voting",
+    "register write", "MQ send", "rollover", "next round wait", "receive", "publish"
+};
+
+TraceSegment *trace_attach(int create, int writable) {
+    return shm_attach(TRACE_SHM, sizeof(TraceSegment), create, writable);
+}
+
+TraceRing *trace_open(const char *role) {
+    TraceSegment *segment = trace_attach(0, 1);
+    pid_t free_pid;
+    int i;
+
+    if (segment == NULL)
+        return NULL;
+    // rings are not reused, the collector reads them after the processes are gone
+    for (i = 0; i < TRACE_PROCS; i++) {
+        free_pid = 0;
+        if (!__atomic_compare_exchange_n(&segment->rings[i].pid, &free_pid, getpid(), 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+        strncpy(segment->rings[i].role, role, TRACE_ROLE - 1);
+        return &segment->rings[i];
+    }
+    munmap(segment, sizeof(TraceSegment));
+    return NULL;
+}
+
+void trace_event(TraceRing *ring, TraceName name, char ph, uint8_t tid, int32_t block) {
+    uint64_t i = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    TraceEvent *event = &ring->events[i % TRACE_EVENTS];
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->ts = now_ns();
+    event->block = block;
+    event->name = name;
+    event->ph = ph;
+    event->tid = tid;
+    __atomic_store_n(&event->seq, (uint32_t)(i + 1), __ATOMIC_RELEASE);
+}
+
+int trace_snapshot(const TraceRing *ring, TraceEvent *events) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), i;
+    const TraceEvent *event;
+    int n = 0;
+
+    for (i = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0; i < head; i++) {
+        event = &ring->events[i % TRACE_EVENTS];
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != (uint32_t)(i + 1))
+            continue; // not written yet
+        events[n] = *event;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // overwritten while it was copied
+        if (__atomic_load_n(&event->seq, __ATOMIC_RELAXED) == (uint32_t)(i + 1))
+            n++;
+    }
+    return n;
+}
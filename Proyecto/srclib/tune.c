@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "../includes/tune.h"
+#include "../includes/metrics.h"
+
+static const int thread_counts[] = {1, 2, 3, 4, 6, 8, 12, 16};
+
+/**
+ * @brief work of a thread while a configuration is measured
+ */
+typedef struct _sample{
+    PowSearch search;
+    long start;
+    long chunk;
+    int *stop;
+    uint64_t hashes;
+} Sample;
+
+static void *sample_work(void *args) {
+    Sample *sample = (Sample*) args;
+    long x = sample->start;
+    while (!__atomic_load_n(sample->stop, __ATOMIC_RELAXED)) {
+        if (x + sample->chunk > POW_LIMIT)
+            x = 0;
+        sample->search(x, x + sample->chunk, -1); // never found, the whole chunk is hashed
+        x += sample->chunk;
+        sample->hashes += sample->chunk;
+    }
+    return NULL;
+}
+
+/**
+ * @brief private function that measures one configuration
+ * @return double hashes/s, 0 if the threads could not be started
+ */
+static double measure(const PowKernel *kernel, long chunk, int nthreads) {
+    pthread_t threads[METRICS_MAX_THREADS];
+    Sample samples[METRICS_MAX_THREADS];
+    struct timespec left = {0, TUNE_SAMPLE_NS};
+    uint64_t start, hashes = 0;
+    int i, stop = 0, started;
+
+    start = now_ns();
+    for (started = 0; started < nthreads; started++) {
+        samples[started] = (Sample){kernel->search, started * (POW_LIMIT / nthreads), chunk, &stop, 0};
+        if (pthread_create(&threads[started], NULL, sample_work, &samples[started]))
+            break;
+    }
+    while (started == nthreads && nanosleep(&left, &left) == -1 && errno == EINTR)
+        ; // a signal of the round, sleep the rest
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        hashes += samples[i].hashes;
+    }
+    return started == nthreads ? hashes * 1e9 / (now_ns() - start) : 0;
+}
+
+void tune_calibrate(Tuning *best, int max_threads) {
+    const long chunks[TUNE_NUM_CHUNKS] = TUNE_CHUNKS;
+    double rate;
+    int k, c, t;
+
+    // kernel and chunk size on one thread, smallest chunk among the ties
+    *best = (Tuning){1, &pow_kernels[0], chunks[0], 0};
+    for (k = 0; k < POW_NUM_KERNELS; k++) {
+        for (c = 0; c < TUNE_NUM_CHUNKS; c++) {
+            rate = measure(&pow_kernels[k], chunks[c], 1);
+            if (rate > best->rate * (1 + TUNE_TIE) || (rate >= best->rate * (1 - TUNE_TIE) && chunks[c] < best->chunk)) {
+                best->kernel = &pow_kernels[k];
+                best->chunk = chunks[c];
+                best->rate = rate;
+            }
+        }
+    }
+    // then the threads, fewest among the ties
+    for (t = 1; t < sizeof(thread_counts) / sizeof(thread_counts[0]) && thread_counts[t] <= max_threads; t++) {
+        rate = measure(best->kernel, best->chunk, thread_counts[t]);
+        if (rate > best->rate * (1 + TUNE_TIE)) {
+            best->nthreads = thread_counts[t];
+            best->rate = rate;
+        }
+    }
+}
+
+void tune_path(char *path, size_t size) {
+    char host[64];
+    if (gethostname(host, sizeof(host)) == -1)
+        strcpy(host, "localhost");
+    host[sizeof(host) - 1] = '\0';
+    snprintf(path, size, TUNE_FILE, host);
+}
+
+int tune_load(Tuning *tuning, const char *path) {
+    char kernel[16];
+    int nthreads;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+        return -1;
+    if (fscanf(file, "%d %15s %ld %lf", &nthreads, kernel, &tuning->chunk, &tuning->rate) != 4
+                || nthreads <= 0 || nthreads > METRICS_MAX_THREADS || tuning->chunk <= 0
+                || (tuning->kernel = pow_kernel(kernel)) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    tuning->nthreads = nthreads;
+    fclose(file);
+    return 0;
+}
+
+int tune_save(const Tuning *tuning, const char *path) {
+    char tmp[128];
+    FILE *file;
+
+    // the miners of a host may calibrate at the same time, each writes its own copy
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    if ((file = fopen(tmp, "w")) == NULL)
+        return -1;
+    fprintf(file, "%d %s %ld %.0f\n", tuning->nthreads, tuning->kernel->name, tuning->chunk, tuning->rate);
+    if (fclose(file) == EOF || rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int tune_drifted(const Tuning *tuning, double rate, int *strikes) {
+    if (rate < tuning->rate * (1 - TUNE_DRIFT) || rate > tuning->rate * (1 + TUNE_DRIFT))
+        (*strikes)++;
+    else
+        *strikes = 0;
+    if (*strikes < TUNE_DRIFT_ROUNDS)
+        return 0;
+    *strikes = 0;
+    return 1;
+}
@@ -0,0 +1,188 @@
+#include "../includes/verify.h"
+#include "../includes/pow.h"
+
+#define NUM_CHUNKS(n) (((n) + VERIFY_CHUNK - 1) / VERIFY_CHUNK)
+
+typedef enum _batchState{
+    BATCH_FREE,
+    BATCH_FILLED, // being verified
+    BATCH_DONE // verified, waiting to be published
+} BatchState;
+
+typedef struct _verifyBatch{
+    Block blocks[VERIFY_BATCH];
+    BlockInfo info[VERIFY_BATCH];
+    int count;
+    int next_chunk; // next chunk to hand to a worker
+    int chunks_left; // chunks not verified yet
+    BatchState state;
+} VerifyBatch;
+
+struct _verifier{
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a batch was submitted
+    pthread_cond_t done; // a batch was verified
+    pthread_cond_t free; // a batch was published
+    VerifyBatch batches[VERIFY_SLOTS];
+    long submitted; // batches submitted, the next one goes to submitted % VERIFY_SLOTS
+    long published; // batches published
+    uint8_t stopping;
+    VerifySink sink;
+    void *arg;
+    int nthreads;
+    pthread_t *workers;
+    pthread_t publisher;
+};
+
+/**
+ * @brief private function that verifies a chunk of a batch
+ */
+static void verify_chunk(VerifyBatch *batch, int chunk) {
+    long solutions[VERIFY_CHUNK], hashes[VERIFY_CHUNK];
+    int i, first = chunk * VERIFY_CHUNK;
+    int n = batch->count - first < VERIFY_CHUNK ? batch->count - first : VERIFY_CHUNK;
+    for (i = 0; i < n; i++)
+        solutions[i] = batch->blocks[first + i].solution;
+    pow_hash_batch(solutions, hashes, n);
+    for (i = 0; i < n; i++)
+        batch->info[first + i] = (BlockInfo){ .verified = hashes[i] == batch->blocks[first + i].target };
+}
+
+/**
+ * @brief private function that the workers execute
+ */
+static void *verify_worker(void *args) {
+    Verifier *v = (Verifier*) args;
+    VerifyBatch *batch = NULL;
+    long seq;
+    int chunk = 0;
+
+    pthread_mutex_lock(&v->lock);
+    while (1) {
+        // oldest batch with chunks left, so batches finish in order
+        for (seq = v->published, batch = NULL; seq < v->submitted; seq++) {
+            batch = &v->batches[seq % VERIFY_SLOTS];
+            if (batch->state == BATCH_FILLED && batch->next_chunk < NUM_CHUNKS(batch->count))
+                break;
+            batch = NULL;
+        }
+        if (batch == NULL) {
+            if (v->stopping)
+                break;
+            pthread_cond_wait(&v->work, &v->lock);
+            continue;
+        }
+        chunk = batch->next_chunk++;
+        pthread_mutex_unlock(&v->lock);
+        verify_chunk(batch, chunk);
+        pthread_mutex_lock(&v->lock);
+        if (--batch->chunks_left == 0) {
+            batch->state = BATCH_DONE;
+            pthread_cond_broadcast(&v->done);
+        }
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+/**
+ * @brief private function that the publisher executes
+ */
+static void *verify_publisher(void *args) {
+    Verifier *v = (Verifier*) args;
+    VerifyBatch *batch;
+    int i;
+
+    pthread_mutex_lock(&v->lock);
+    while (1) {
+        batch = &v->batches[v->published % VERIFY_SLOTS];
+        if (v->published < v->submitted && batch->state == BATCH_DONE) {
+            pthread_mutex_unlock(&v->lock);
+            for (i = 0; i < batch->count; i++)
+                v->sink(&batch->blocks[i], &batch->info[i], v->arg);
+            pthread_mutex_lock(&v->lock);
+            batch->state = BATCH_FREE;
+            v->published++;
+            pthread_cond_broadcast(&v->free);
+            continue;
+        }
+        if (v->stopping && v->published == v->submitted)
+            break;
+        pthread_cond_wait(&v->done, &v->lock);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+Verifier *verifier_start(int nthreads, VerifySink sink, void *arg) {
+    Verifier *v = calloc(1, sizeof(Verifier));
+    int i;
+    if (v == NULL)
+        return NULL;
+    v->workers = malloc(nthreads * sizeof(pthread_t));
+    if (v->workers == NULL) {
+        free(v);
+        return NULL;
+    }
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_cond_init(&v->work, NULL);
+    pthread_cond_init(&v->done, NULL);
+    pthread_cond_init(&v->free, NULL);
+    v->sink = sink;
+    v->arg = arg;
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&v->workers[i], NULL, verify_worker, v))
+            break;
+        v->nthreads++;
+    }
+    if (v->nthreads == 0 || pthread_create(&v->publisher, NULL, verify_publisher, v)) {
+        perror("pthread_create");
+        v->stopping = 1;
+        pthread_cond_broadcast(&v->work);
+        for (i = 0; i < v->nthreads; i++)
+            pthread_join(v->workers[i], NULL);
+        free(v->workers);
+        free(v);
+        return NULL;
+    }
+    return v;
+}
+
+void verifier_submit(Verifier *v, const Block *blocks, int n) {
+    VerifyBatch *batch;
+    if (n <= 0)
+        return;
+    pthread_mutex_lock(&v->lock);
+    batch = &v->batches[v->submitted % VERIFY_SLOTS];
+    while (batch->state != BATCH_FREE)
+        pthread_cond_wait(&v->free, &v->lock);
+    pthread_mutex_unlock(&v->lock);
+    // the slot is free, nobody else touches it until it is submitted
+    memcpy(batch->blocks, blocks, n * sizeof(Block));
+    batch->count = n;
+    batch->next_chunk = 0;
+    batch->chunks_left = NUM_CHUNKS(n);
+    pthread_mutex_lock(&v->lock);
+    batch->state = BATCH_FILLED;
+    v->submitted++;
+    pthread_cond_broadcast(&v->work);
+    pthread_mutex_unlock(&v->lock);
+}
+
+void verifier_stop(Verifier *v) {
+    int i;
+    pthread_mutex_lock(&v->lock);
+    v->stopping = 1;
+    pthread_cond_broadcast(&v->work);
+    pthread_cond_broadcast(&v->done);
+    pthread_mutex_unlock(&v->lock);
+    for (i = 0; i < v->nthreads; i++)
+        pthread_join(v->workers[i], NULL);
+    pthread_join(v->publisher, NULL);
+    pthread_mutex_destroy(&v->lock);
+    pthread_cond_destroy(&v->work);
+    pthread_cond_destroy(&v->done);
+    pthread_cond_destroy(&v->free);
+    free(v->workers);
+    free(v);
+}